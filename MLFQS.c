@@ -1,7 +1,16 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include "prioque.h"
+#include "histogram.h"
+#include "mlfqs-live.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 // ANTHONY ALVAREZ (89-9962639)
 // MLFQS.C will simulate a four-level multi-level feedback queue scheduler.
@@ -49,6 +58,18 @@
 // row, to be promoted. So the "g" can't be reset when the process does an I/O,
 // or you can't track this.
 
+// Latency metrics kept for each process (see METRICS below). Times
+// are clock ticks.
+typedef struct ProcessMetrics {
+	unsigned long readySince;		// When the process last became ready.
+	unsigned long levelSince;		// When the process entered its current level.
+	unsigned long waitTime;			// Total ticks spent ready but not running.
+	int started;					// Set once the process has first run.
+	int demotions;					// # of times moved down a level.
+	int promotions;					// # of times moved up a level.
+	int preemptions;				// # of times kicked off by a higher level.
+} ProcessMetrics;
+
 // This Process Struct will represent a "process" in the CPU Scheduler.
 // The struct will keep track of its Burst, IO, repeat, and more while
 // also keeping track of the limits of each g, b, and quantum based on
@@ -70,6 +91,10 @@ typedef struct Process {
 	int bLim;						// Max "b" till demotion
 	int gLim;						// Max "g" till promotion 
 	struct Process * nextSet;		// Further Explanation below..
+	ProcessMetrics metrics;			// Latency metrics, carried with the process.
+	unsigned long boostEpoch;		// Last priority boost applied to the process.
+	unsigned long levelStartCPU;	// usageCPU when the process entered its level.
+	unsigned int migrations;		// Level changes since the process last ran.
 } Process;
 
 // Further Explanation on nextSet:
@@ -86,6 +111,15 @@ typedef struct Process {
 //						  ^^
 //						  P3
 
+// processCompare() matches two processes by PID.
+static inline int processCompare(const Process *p1, const Process *p2) {
+	return p1->PID != p2->PID;
+}
+
+// Typed queue operations (Process_add_to_queue() etc.) for the
+// scheduler queues. They copy a whole Process with one assignment.
+DEFINE_PRIOQUE(Process, processCompare)
+
 // FUTURE CORRECTIONS:
 // 
 // This might make me lose points but... my IO is incorrect.
@@ -103,11 +137,34 @@ int processesExist();
 int readyProcessExists();
 void* grabAReadyProcess(Process*);
 void init_all_queues();
-void deleteFromQ(Process*);
+Queue* levelQueue(int);
+void moveFromLevel(Process*, Queue*);
 void demoteProcess(Process*);
-void demotionAndPromotionCheck(Process*);
+void demotionAndPromotionCheck(Process*, Queue*);
 void insertAtRear(Process*);
 void updateValues(Process*);
+unsigned long profileNow();
+unsigned long profileSection(int, unsigned long);
+void profileEvent(int, unsigned long);
+void printProfile();
+void metricsReady(Process*);
+void metricsDispatch(Process*);
+void metricsLevelChange(Process*, int);
+void metricsFinish(Process*);
+void printMetrics();
+void occupancyChange();
+void takeSample();
+void flushSamples();
+void finishSampling();
+int liveAttach(const char*);
+void livePublish(int);
+void boostAll();
+void applyBoost(Process*);
+int allotmentSpent(Process*);
+int demotionDue(Process*);
+void costDispatch(Process*);
+int overheadPending();
+void consumeOverhead();
 
 // ALL GLOBAL VARIABLES OR STRUCTS
 Queue preScheduleProcs;	// Queue that stores all the input processes pre-Schedule.
@@ -117,12 +174,201 @@ Queue level2;			// The Level 2 Queue for the MLFQS
 Queue level3;			// The Level 3 Queue for the MLFQS
 Queue level4;			// The Level 4 Queue for the MLFQS
 Queue terminated;		// Queue that stores all the terminated processes.
+Queue_arena simArena;		// Backs every queue above, released in one go.
 Process nullProc = {0,0};			// <<NULL>> process that ticks when scheduler empty.
 Process currExecuting = {0,0};		// Process that is currently executing.
 unsigned long schedClock=0;			// The clock used to keep track of ticks.
 
+// PROFILING (-p)
+//
+// With -p, the time spent in each section of the scheduler loop and in
+// handling each kind of event is recorded in histograms and reported on
+// stderr at shutdown. Times are in TSC cycles on x86 and nanoseconds
+// elsewhere. Without -p, the only cost is a flag check per section.
+enum { SEC_ARRIVALS, SEC_EXECUTION, SEC_IO, SEC_CLOCK, NUM_SECTIONS };
+enum { EV_DISPATCH, EV_PREEMPT, EV_DEMOTE, EV_IO_DONE, NUM_EVENTS };
+const char *sectionNames[NUM_SECTIONS] = {"SEC 1: ARRIVALS", "SEC 2: EXECUTION",
+	"SEC 3: IO/PROMO/DEMO/EXIT", "SEC 4: CLOCK TICK"};
+const char *eventNames[NUM_EVENTS] = {"dispatch", "preempt", "demote", "I/O completion"};
+int profiling = 0;					// Set by -p.
+Histogram sectionTime[NUM_SECTIONS];	// Time per loop iteration in each section.
+Histogram eventTime[NUM_EVENTS];		// Time to handle each event.
+
+// METRICS (-m)
+//
+// With -m, per-process latencies are recorded in histograms, overall
+// and per level, and reported on stderr at shutdown. Each process
+// carries its own running totals (ProcessMetrics), and the histograms
+// are fixed-size, so nothing is allocated however many processes run.
+int metrics = 0;					// Set by -m.
+Histogram turnaroundHist;			// Arrival to finish.
+Histogram responseHist;				// Arrival to first RUN.
+Histogram waitHist;					// Total ready-queue wait per process.
+Histogram demotionHist;				// Demotions per process.
+Histogram promotionHist;			// Promotions per process.
+Histogram preemptionHist;			// Preemptions per process.
+Histogram levelWaitHist[4];			// Each ready-queue wait, by level.
+Histogram levelResidencyHist[4];	// Each stay in a level, by level.
+
+// OCCUPANCY SAMPLING (-s file, -i interval)
+//
+// With -s, the time-weighted mean of each gauge below is written to
+// a columnar file for every interval (-i, default 100 ticks), along
+// with the level running at the end of the interval. Each gauge keeps
+// the integral of its value over time, which is brought up to date
+// only when the scheduler state changes (occupancyChange()), so idle
+// stretches and long bursts cost nothing per tick.
+//
+// File layout (host byte order):
+//   header: "MLFQSOCC", uint32 version (1), uint32 # of gauges,
+//           uint64 interval, then the gauge names, each NUL-terminated
+//   blocks: uint32 # of rows, then column by column: uint64 end tick
+//           of each interval, one float32 mean per row for each gauge
+//           in header order, uint8 running level (0 if idle)
+enum { GAUGE_LEVEL1, GAUGE_LEVEL2, GAUGE_LEVEL3, GAUGE_LEVEL4, GAUGE_BLOCKED, GAUGE_BUSY, NUM_GAUGES };
+const char *gaugeNames[NUM_GAUGES] = {"level1", "level2", "level3", "level4", "blocked", "busy"};
+#define SAMPLE_BLOCK 4096			// Rows buffered per block written.
+FILE *sampleFile = NULL;			// Set by -s.
+unsigned long sampleInterval = 100;	// Set by -i.
+unsigned long nextSample;			// Tick that ends the current interval.
+unsigned long lastSample = 0;		// Tick that began the current interval.
+unsigned long gaugeValue[NUM_GAUGES];	// Value of each gauge since gaugeSince.
+unsigned long gaugeArea[NUM_GAUGES];	// Integral of each gauge up to gaugeSince.
+unsigned long gaugeSince = 0;		// Tick of the last state change.
+unsigned long sampleArea[NUM_GAUGES];	// gaugeArea as of lastSample.
+unsigned long sampleTick[SAMPLE_BLOCK];
+float sampleMean[NUM_GAUGES][SAMPLE_BLOCK];
+unsigned char sampleRunning[SAMPLE_BLOCK];
+unsigned int sampleRows = 0;		// Rows buffered so far.
+
+// LIVE STATISTICS (-l name)
+//
+// With -l, counters are published to the POSIX shared-memory segment
+// "name" every LIVE_PUBLISH_TICKS ticks, for mlfqs-top to display.
+// Publishing copies liveStats into the segment under a seqlock (see
+// mlfqs-live.h), so the simulation never waits on a monitor. The
+// event counters below are kept whether or not -l is given; they are
+// plain increments.
+#define LIVE_PUBLISH_TICKS 64
+MLFQSLive *liveShm = NULL;			// Set by -l.
+const char *liveName = NULL;		// Segment name, unlinked at shutdown.
+MLFQSLiveStats liveStats;			// Counters, copied out by livePublish().
+
+// PRIORITY BOOST (-B period)
+//
+// With -B, every "period" ticks all processes go back to level 1 so
+// CPU-bound processes at the lower levels can't starve. Levels 2-4
+// are spliced onto the rear of level 1 whole, in order, so a boost
+// costs the same however many processes are queued. The per-process
+// reset (level, b, g and quantum) is deferred: a boost just starts a
+// new boostEpoch, and applyBoost() brings a process up to date the
+// next time it is picked to run or returns from I/O.
+unsigned long boostPeriod = 0;		// Set by -B, 0 for no boosts.
+unsigned long boostEpoch = 0;		// # of boosts so far.
+unsigned long lastBoost = 0;		// Time of the last boost.
+
+// ALLOTMENT MODE (-A)
+//
+// By default a process is demoted after using its whole quantum "b"
+// times in a row, so one that always blocks just before its quantum
+// runs out is never demoted. With -A, a process is instead demoted
+// once its total CPU time at a level reaches that level's allotment,
+// however it was split up by I/O. The CPU time at a level is usageCPU
+// minus its value on entering the level, so the check is one
+// subtraction and nothing extra is counted per tick. The allotments
+// match the default rule for processes that don't block early
+// ("b" quanta per level); level 4 has no limit. The "g" promotion rule
+// rewards the same trick, so it is off in this mode; use -B to move
+// processes back up.
+int allotmentMode = 0;				// Set by -A.
+unsigned long levelAllotment[4] = {10, 60, 200, 0};
+
+// SWITCH COST MODEL (-C switch[,refill[,migration]])
+//
+// With -C, each dispatch costs CPU ticks before the process makes
+// progress: "switch" ticks for every context switch, "refill" more
+// if another PID ran since (cold caches), and "migration" more for
+// each level change since the process last ran. These ticks count as
+// neither process nor <<null>> time; the final report shows them as
+// overhead, by kind. A dispatch's overhead isn't preemptible.
+enum { COST_SWITCH, COST_REFILL, COST_MIGRATION, NUM_COSTS };
+const char *costNames[NUM_COSTS] = {"switch", "refill", "migration"};
+int costModel = 0;					// Set by -C.
+unsigned long costTicks[NUM_COSTS];	// Cost of each kind, per occurrence.
+unsigned long overheadLeft[NUM_COSTS];	// Overhead left for the current dispatch.
+unsigned long overheadUsed[NUM_COSTS];	// Overhead ticks spent so far.
+unsigned long lastRunPID = 0;		// PID of the last process dispatched.
+
 int main(int argc, char *argv[]) {
 
+	// OPTIONS:
+	// -p  profile the scheduler loop (report on stderr)
+	// -m  per-process latency metrics (report on stderr)
+	// -s  write queue occupancy samples to a file
+	// -i  occupancy sampling interval in ticks
+	// -l  publish live statistics to a shared-memory segment
+	// -B  boost all processes to level 1 every given # of ticks
+	// -A  demote on cumulative CPU time per level (allotment mode)
+	// -C  charge ticks for context switches, cache refills, migrations
+	int opt;
+	while((opt = getopt(argc, argv, "pms:i:l:B:AC:")) != -1) {
+		switch(opt) {
+			case 'p':
+				profiling = 1;
+				break;
+			case 'm':
+				metrics = 1;
+				break;
+			case 's':
+				sampleFile = fopen(optarg, "wb");
+				if(sampleFile == NULL) {
+					perror(optarg);
+					return 1;
+				}
+				break;
+			case 'i':
+				sampleInterval = strtoul(optarg, NULL, 10);
+				break;
+			case 'l':
+				if(!liveAttach(optarg)) {
+					return 1;
+				}
+				break;
+			case 'B':
+				boostPeriod = strtoul(optarg, NULL, 10);
+				break;
+			case 'A':
+				allotmentMode = 1;
+				break;
+			case 'C':
+				if(sscanf(optarg, "%lu,%lu,%lu", &costTicks[COST_SWITCH], &costTicks[COST_REFILL],
+				&costTicks[COST_MIGRATION]) < 1) {
+					fprintf(stderr, "%s: -C takes switch[,refill[,migration]] tick costs\n", argv[0]);
+					return 2;
+				}
+				costModel = 1;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-p] [-m] [-s samplefile [-i interval]] [-l shmname] [-B period] [-A] [-C switch[,refill[,migration]]] < input\n", argv[0]);
+				return 2;
+		}
+	}
+	if(sampleInterval == 0) {
+		fprintf(stderr, "%s: sampling interval must be positive\n", argv[0]);
+		return 2;
+	}
+	if(sampleFile) {
+		unsigned int version = 1, gauges = NUM_GAUGES;
+		fwrite("MLFQSOCC", 1, 8, sampleFile);
+		fwrite(&version, sizeof(version), 1, sampleFile);
+		fwrite(&gauges, sizeof(gauges), 1, sampleFile);
+		fwrite(&sampleInterval, sizeof(sampleInterval), 1, sampleFile);
+		for(int i = 0; i < NUM_GAUGES; i++) {
+			fwrite(gaugeNames[i], 1, strlen(gaugeNames[i]) + 1, sampleFile);
+		}
+		nextSample = sampleInterval;
+	}
+
 	// Initializing All Queues.
 	init_all_queues();
 
@@ -137,7 +383,10 @@ int main(int argc, char *argv[]) {
 		newProcess.burstRemaining = newProcess.burst;
 		newProcess.IORemaining = newProcess.IO;
 		newProcess.usageCPU = 0;
+		newProcess.levelStartCPU = 0;
+		newProcess.migrations = 0;
 		newProcess.nextSet = NULL;
+		memset(&newProcess.metrics, 0, sizeof(ProcessMetrics));
 		if(!empty_queue(&preScheduleProcs)) {
 			// If new process is the same PID as the previous one,
 			// make the previous point to the new process to set up
@@ -151,6 +400,7 @@ int main(int argc, char *argv[]) {
 				nextBehavior->PID = newProcess.PID;
 				nextBehavior->repeat = newProcess.repeat;
 				nextBehavior->arrivalTime = newProcess.arrivalTime;
+				nextBehavior->nextSet = NULL;
 				prevP->nextSet = nextBehavior;
 				prevP = nextBehavior;
 			}
@@ -158,19 +408,14 @@ int main(int argc, char *argv[]) {
 			// add as normal and set it as the previous process in case the new
 			// processes are the same PID.
 			else {
-				add_to_queue(&preScheduleProcs, &newProcess, 0);
-				while(!end_of_queue(&preScheduleProcs)) {
-					prevP = (Process *) pointer_to_current(&preScheduleProcs);
-					next_element(&preScheduleProcs);
-				}
+				prevP = Process_pointer_to_handle(Process_add_to_queue_handle(&preScheduleProcs, &newProcess, 0));
 			}
 			
 		}
 		// Essentially only runs one time, for the first process.
 		// Add to the queue and set it as previous.
 		else {
-			add_to_queue(&preScheduleProcs, &newProcess, 0);
-			prevP = (Process *) pointer_to_current(&preScheduleProcs);
+			prevP = Process_pointer_to_handle(Process_add_to_queue_handle(&preScheduleProcs, &newProcess, 0));
 		}
 	}
 	prevP = NULL;
@@ -187,21 +432,24 @@ int main(int argc, char *argv[]) {
 
 		// currArriving will keep track of the current arriving process.
 		Process currArriving;
+		// Start of the section being profiled, and of an event being handled.
+		unsigned long sectionStart = profiling ? profileNow() : 0;
+		unsigned long eventStart;
 		rewind_queue(&preScheduleProcs);
-		peek_at_current(&preScheduleProcs, &currArriving, 0);
 		
 		/// SECTION 1: ARRIVALS
 		// This section checks the arrTime of the processes stored in "preScheduleProcs"
 		// and if it matches the clock, processes are sent to the level 1 queue.
+		// Every process arriving at this tick is sent, in input order.
 		// If it doesnt match, move to the execution section of the scheduler.
-		if(currArriving.arrivalTime == schedClock) {
+		while(Process_peek_at_current(&preScheduleProcs, &currArriving, 0) != NULL &&
+		currArriving.arrivalTime == schedClock) {
 			printf("PID: %lu, ARRIVAL TIME: %lu\n",
 			currArriving.PID, currArriving.arrivalTime);
 			printf("CREATE: Process %lu entered the ready queue at time %lu.\n", 
 					currArriving.PID, schedClock);
-			// Remove from the preSchedule queue and
-			// update with level 1 queues b, g, quantum values.
-			delete_current(&preScheduleProcs);
+			// Update with level 1 queues b, g, quantum values and
+			// move from the preSchedule queue to level 1.
 			currArriving.quantum = 10;
 			currArriving.quantumRemaining = 10;
 			currArriving.inWhichQueue = 1;
@@ -209,8 +457,15 @@ int main(int argc, char *argv[]) {
 			currArriving.bLim = 1;
 			currArriving.g = 0;
 			currArriving.b = 0;
-			add_to_queue(&level1, &currArriving, 0);
+			currArriving.metrics.levelSince = schedClock;
+			currArriving.boostEpoch = boostEpoch;
+			metricsReady(&currArriving);
+			update_current(&preScheduleProcs, &currArriving);
+			move_handle(&level1, &preScheduleProcs, current_handle(&preScheduleProcs), 0);
+			liveStats.created++;
+			occupancyChange();
 		}
+		sectionStart = profileSection(SEC_ARRIVALS, sectionStart);
 
 		// SECTION 2: EXECUTION
 		// This section represents the execution phase of a process.
@@ -228,11 +483,21 @@ int main(int argc, char *argv[]) {
 		// If no process running but there exists some ready
 		// processes, then set highest process as running process.
 		else if(currExecuting.PID == 0) {
+				eventStart = profiling ? profileNow() : 0;
 				grabAReadyProcess(&currExecuting);
+				metricsDispatch(&currExecuting);
+				costDispatch(&currExecuting);
 				printf("RUN: Process %lu started execution from level %d at time %lu; ",
 				currExecuting.PID, currExecuting.inWhichQueue, schedClock);
 				printf("wants to execute for %lu ticks.\n", 
 				currExecuting.burstRemaining);
+				profileEvent(EV_DISPATCH, eventStart);
+				occupancyChange();
+		}
+		// If the CPU is still switching to the process (-C), it makes
+		// no progress this tick.
+		else if(overheadPending()) {
+			consumeOverhead();
 		}
 		// If a process is currently running, then continue execution
 		else {
@@ -240,6 +505,7 @@ int main(int argc, char *argv[]) {
 			currExecuting.burstRemaining--;
 			currExecuting.quantumRemaining--;
 			currExecuting.usageCPU++;
+			liveStats.levelRunTicks[currExecuting.inWhichQueue - 1]++;
 			
 			// If burst is 0, check if IO needs to be done or process is finished
 			if(currExecuting.burstRemaining == 0) {
@@ -258,33 +524,38 @@ int main(int argc, char *argv[]) {
 					currExecuting.quantumRemaining = currExecuting.quantum;
 					printf("I/O: Process %lu blocked for I/O at time %lu.\n", 
 						currExecuting.PID, schedClock);
-					add_to_queue(&blocked, &currExecuting, 0);
-					deleteFromQ(&currExecuting);
+					moveFromLevel(&currExecuting, &blocked);
 					currExecuting = nullProc;
 				}
 				// If no burst and IO, then process is finished and must be terminated.
 				else {
 					printf("FINISHED: Process %lu finished at time %lu.\n",
 						currExecuting.PID, schedClock);
-					add_to_queue(&terminated, &currExecuting, 0);
-					deleteFromQ(&currExecuting);
+					metricsFinish(&currExecuting);
+					moveFromLevel(&currExecuting, &terminated);
 					currExecuting = nullProc;
 				}
 
 			}
 			// If burst is not 0, check if quantum was met
-			else if(currExecuting.quantumRemaining == 0) {
+			// (With -A, also stop if the level's allotment ran out mid-quantum.)
+			else if(currExecuting.quantumRemaining == 0 || allotmentSpent(&currExecuting)) {
 				currExecuting.b++;
 				currExecuting.g = 0;
 
 				// Demotion checking, if b = bLim (b's limit for queue level) then demote.
-				if(currExecuting.b == currExecuting.bLim) {
+				if(demotionDue(&currExecuting)) {
+					eventStart = profiling ? profileNow() : 0;
 					currExecuting.inWhichQueue++;
 					printf("QUEUED: Process %lu queued at level %d at time %lu.\n",
 					currExecuting.PID, currExecuting.inWhichQueue, schedClock);
+					metricsLevelChange(&currExecuting, currExecuting.inWhichQueue - 1);
+					currExecuting.migrations++;
+					metricsReady(&currExecuting);
 					// In demotion & promotion, I set the b, g, and quantum requirements.
 					demoteProcess(&currExecuting);
 					currExecuting = nullProc;
+					profileEvent(EV_DEMOTE, eventStart);
 				}
 				else {
 					// If b was counted up but it is not enough to demote, then we put
@@ -292,6 +563,7 @@ int main(int argc, char *argv[]) {
 					currExecuting.quantumRemaining = currExecuting.quantum;
 					printf("QUEUED: Process %lu queued at level %d at time %lu.\n",
 					currExecuting.PID, currExecuting.inWhichQueue, schedClock);
+					metricsReady(&currExecuting);
 					insertAtRear(&currExecuting);
 					currExecuting = nullProc;
 				}
@@ -305,13 +577,19 @@ int main(int argc, char *argv[]) {
 
 				if(readyProcessExists(&level1,&level2,&level3,&level4)) {
 
+					eventStart = profiling ? profileNow() : 0;
 					grabAReadyProcess(&currExecuting);
+					metricsDispatch(&currExecuting);
+					costDispatch(&currExecuting);
 					printf("RUN: Process %lu started execution from level %d at time %lu; ",
 					currExecuting.PID, currExecuting.inWhichQueue, schedClock);
 					printf("wants to execute for %lu ticks.\n",
 					currExecuting.burstRemaining);
+					profileEvent(EV_DISPATCH, eventStart);
 
 				}
+				// The running process stopped this tick.
+				occupancyChange();
 
 			}
 			// If process is currently executing, check if there exists a higher
@@ -324,19 +602,27 @@ int main(int argc, char *argv[]) {
 
 				if(currExecuting.inWhichQueue > temp.inWhichQueue) {
 
+					eventStart = profiling ? profileNow() : 0;
 					printf("QUEUED: Process %lu queued at level %d at time %lu.\n",
 					currExecuting.PID, currExecuting.inWhichQueue, schedClock);
+					currExecuting.metrics.preemptions++;
+					liveStats.levelPreemptions[currExecuting.inWhichQueue - 1]++;
+					metricsReady(&currExecuting);
 					updateValues(&currExecuting);
 					grabAReadyProcess(&currExecuting);
+					metricsDispatch(&currExecuting);
+					costDispatch(&currExecuting);
 					printf("RUN: Process %lu started execution from level %d at time %lu; ",
 					currExecuting.PID, currExecuting.inWhichQueue, schedClock);
 					printf("wants to execute for %lu ticks.\n",
 					currExecuting.burstRemaining);
+					profileEvent(EV_PREEMPT, eventStart);
 				}
 
 			}
 				
 		}
+		sectionStart = profileSection(SEC_EXECUTION, sectionStart);
 		
 
 		// Section 3: IO / Promotion / Demotion / Exit
@@ -349,12 +635,13 @@ int main(int argc, char *argv[]) {
 			rewind_queue(&blocked);
 			while(!end_of_queue(&blocked)) {
 
-				Process *curr = (Process *) pointer_to_current(&blocked);
+				Process *curr = Process_pointer_to_current(&blocked);
 				curr->IORemaining--;
 				
 				// If a process has no remaining IO, return them to their queue.
 				if(curr->IORemaining == 0) {
 					
+					eventStart = profiling ? profileNow() : 0;
 					curr->repeat--;
 					// If repeat is 0, check if a process has "child"
 					// behaviors. If so, reset process with new behaviors,
@@ -388,8 +675,8 @@ int main(int argc, char *argv[]) {
 						curr->IORemaining = curr->IO;
 					}
 
-					demotionAndPromotionCheck(curr);
-					delete_current(&blocked);
+					demotionAndPromotionCheck(curr, &blocked);
+					profileEvent(EV_IO_DONE, eventStart);
 				}
 				
 				// This makes sure that we dont move forward
@@ -400,6 +687,7 @@ int main(int argc, char *argv[]) {
 				}
 			}
 		}
+		sectionStart = profileSection(SEC_IO, sectionStart);
 
 		// EXIT CHECK
 		// If the last process finished its execution, close the scheduler, we are done!
@@ -408,31 +696,83 @@ int main(int argc, char *argv[]) {
 		}
 
 		schedClock++;
+		if(boostPeriod && schedClock % boostPeriod == 0) {
+			boostAll();
+		}
+		if(sampleFile && schedClock == nextSample) {
+			takeSample();
+		}
+		if(liveShm && schedClock % LIVE_PUBLISH_TICKS == 0) {
+			livePublish(0);
+		}
+		profileSection(SEC_CLOCK, sectionStart);
 	}
 
 	// FINAL OUTPUT SECTION
 	printf("Scheduler shutdown at time %lu.\n", schedClock);
 	printf("Total CPU usage for all processes scheduled:\n");
 	printf("Process <<null>>:\t%lu time units.\n", nullProc.usageCPU);
-	rewind_queue(&terminated);
-	while(!end_of_queue(&terminated)) {
-		Process *curr = (Process *) pointer_to_current(&terminated);
+	if(costModel) {
+		printf("Switch overhead:\t%lu time units (switch %lu, refill %lu, migration %lu).\n",
+		overheadUsed[COST_SWITCH] + overheadUsed[COST_REFILL] + overheadUsed[COST_MIGRATION],
+		overheadUsed[COST_SWITCH], overheadUsed[COST_REFILL], overheadUsed[COST_MIGRATION]);
+	}
+	Queue_iterator report;
+	init_iterator(&terminated, &report, FALSE);
+	while(!iterator_end(&report)) {
+		Process *curr = (Process *) iterator_pointer(&report);
 		printf("Process %lu:\t\t%lu time units.\n", curr->PID, curr->usageCPU);
-		next_element(&terminated);
+		iterator_next(&report);
+	}
+	destroy_iterator(&report);
+	if(profiling) {
+		printProfile();
+	}
+	if(metrics) {
+		printMetrics();
+	}
+	if(sampleFile) {
+		finishSampling();
+	}
+	if(liveShm) {
+		livePublish(1);
+		munmap(liveShm, sizeof(MLFQSLive));
+		shm_unlink(liveName);
 	}
 
+	// Tear down the simulation. Queues on the arena drop their
+	// elements in O(1), then the arena releases all the memory.
+	destroy_queue(&preScheduleProcs);
+	destroy_queue(&blocked);
+	destroy_queue(&level1);
+	destroy_queue(&level2);
+	destroy_queue(&level3);
+	destroy_queue(&level4);
+	destroy_queue(&terminated);
+	destroy_queue_arena(&simArena);
 }
 
 // init_all_queues() will initialize all the queues that we will
 // be using for the scheduler.
 void init_all_queues() {
-	init_queue(&preScheduleProcs, sizeof(Process), TRUE, FALSE, FALSE);
-	init_queue(&blocked, sizeof(Process), TRUE, FALSE, FALSE);
-	init_queue(&level1, sizeof(Process), TRUE, FALSE, FALSE);
-	init_queue(&level2, sizeof(Process), TRUE, FALSE, FALSE);
-	init_queue(&level3, sizeof(Process), TRUE, FALSE, FALSE);
-	init_queue(&level4, sizeof(Process), TRUE, FALSE, FALSE);
-	init_queue(&terminated, sizeof(Process), TRUE, FALSE, FALSE);
+	init_queue_arena(&simArena, 64 * 1024, FALSE);
+	init_queue_with_arena(&preScheduleProcs, sizeof(Process), TRUE, FALSE, FALSE, &simArena);
+	init_queue_with_arena(&blocked, sizeof(Process), TRUE, FALSE, FALSE, &simArena);
+	init_queue_with_arena(&level1, sizeof(Process), TRUE, FALSE, FALSE, &simArena);
+	init_queue_with_arena(&level2, sizeof(Process), TRUE, FALSE, FALSE, &simArena);
+	init_queue_with_arena(&level3, sizeof(Process), TRUE, FALSE, FALSE, &simArena);
+	init_queue_with_arena(&level4, sizeof(Process), TRUE, FALSE, FALSE, &simArena);
+	init_queue_with_arena(&terminated, sizeof(Process), TRUE, FALSE, FALSE, &simArena);
+
+	// Queue counters are dumped to stderr at exit when prioque is
+	// built with -DPRIOQUE_STATS; otherwise these do nothing.
+	report_queue_stats(&preScheduleProcs, "preScheduleProcs");
+	report_queue_stats(&blocked, "blocked");
+	report_queue_stats(&level1, "level1");
+	report_queue_stats(&level2, "level2");
+	report_queue_stats(&level3, "level3");
+	report_queue_stats(&level4, "level4");
+	report_queue_stats(&terminated, "terminated");
 }
 
 // processesExist() checks if atleast one process exists in
@@ -477,27 +817,31 @@ void* grabAReadyProcess(Process *proc) {
 	// level 2 and onward.
 
 	void *ele = NULL;
-	if(pointer_to_current(&level1) != NULL) {
+	if(Process_pointer_to_current(&level1) != NULL) {
 		rewind_queue(&level1);
-		peek_at_current(&level1, proc, 0);
+		Process_peek_at_current(&level1, proc, 0);
+		applyBoost(proc);
 		ele = (void *) proc;
 		return ele;
 	}
-	else if(pointer_to_current(&level2) != NULL) {		
+	else if(Process_pointer_to_current(&level2) != NULL) {		
 		rewind_queue(&level2);
-		peek_at_current(&level2, proc, 0);
+		Process_peek_at_current(&level2, proc, 0);
+		applyBoost(proc);
 		ele = (void *) proc;
 		return ele;
 	}
-	else if(pointer_to_current(&level3) != NULL) {
+	else if(Process_pointer_to_current(&level3) != NULL) {
 		rewind_queue(&level3);
-		peek_at_current(&level3, proc, 0);
+		Process_peek_at_current(&level3, proc, 0);
+		applyBoost(proc);
 		ele = (void *) proc;
 		return ele;
 	}
-	else if(pointer_to_current(&level4) != NULL) {
+	else if(Process_pointer_to_current(&level4) != NULL) {
 		rewind_queue(&level4);
-		peek_at_current(&level4, proc, 0);
+		Process_peek_at_current(&level4, proc, 0);
+		applyBoost(proc);
 		ele = (void *) proc;
 		return ele;
 	}
@@ -506,36 +850,41 @@ void* grabAReadyProcess(Process *proc) {
 	}
 }
 
-// delFromQ() will determine the queue that toBeDel is contained in,
-// and delete it from that queue.
-void deleteFromQ(Process *toBeDel) {
+// levelQueue() returns the level 1-4 queue for the given level.
+Queue* levelQueue(int level) {
 
-	switch(toBeDel->inWhichQueue) {
+	switch(level) {
 		case 1:
-			delete_current(&level1);
-			break;
+			return &level1;
 		case 2:
-			delete_current(&level2);
-			break;
+			return &level2;
 		case 3:
-			delete_current(&level3);
-			break;
+			return &level3;
 		case 4:
-			delete_current(&level4);
-			break;
+			return &level4;
 		default:
 			printf("ERROR: process is lost\n");
 			exit(0);
-			break;
 	}
 }
 
+// moveFromLevel() will determine the queue that toBeMoved is contained in,
+// store its latest values there, and move it to the rear of queue "to".
+// The queued element is relinked rather than copied.
+void moveFromLevel(Process *toBeMoved, Queue *to) {
+
+	Queue *from = levelQueue(toBeMoved->inWhichQueue);
+	update_current(from, toBeMoved);
+	move_handle(to, from, current_handle(from), 0);
+}
+
 // demotionProcess() will check what level the process is in,
 // update the requirements for b, g, and quantum to match new
-// level, add it to the new level queue, and then delete
-// it from the old level.
+// level, and then move it from the old level to the new level queue.
 void demoteProcess(Process *toBeDemoted) {
 
+	Queue *from;
+
 	switch(toBeDemoted->inWhichQueue) {
 		case 2:
 			toBeDemoted->b = 0;
@@ -543,8 +892,7 @@ void demoteProcess(Process *toBeDemoted) {
 			toBeDemoted->gLim = 1;
 			toBeDemoted->quantum = 30;
 			toBeDemoted->quantumRemaining = 30;
-			add_to_queue(&level2, toBeDemoted, 0);
-			delete_current(&level1);
+			from = &level1;
 			break;
 		case 3:
 			toBeDemoted->b = 0;
@@ -552,8 +900,7 @@ void demoteProcess(Process *toBeDemoted) {
 			toBeDemoted->gLim = 2;
 			toBeDemoted->quantum = 100;
 			toBeDemoted->quantumRemaining = 100;
-			add_to_queue(&level3, toBeDemoted, 0);
-			delete_current(&level2);
+			from = &level2;
 			break;
 		case 4:
 			toBeDemoted->b = 0;
@@ -561,8 +908,7 @@ void demoteProcess(Process *toBeDemoted) {
 			toBeDemoted->gLim = 2;
 			toBeDemoted->quantum = 200;
 			toBeDemoted->quantumRemaining = 200;
-			add_to_queue(&level4, toBeDemoted, 0);
-			delete_current(&level3);
+			from = &level3;
 			break;
 		default:
 			printf("ERROR: Process is lost.\n");
@@ -570,19 +916,30 @@ void demoteProcess(Process *toBeDemoted) {
 			break;
 	}
 
+	toBeDemoted->levelStartCPU = toBeDemoted->usageCPU;
+	update_current(from, toBeDemoted);
+	move_handle(levelQueue(toBeDemoted->inWhichQueue), from, current_handle(from), 0);
 }
 
 // demotionAndPromotionCheck() will check the queue that curr is in
 // and check if it needs to be demoted or promoted based on the
 // requirements of the level that contains the curr process.
-void demotionAndPromotionCheck(Process *curr) {
+// curr must be the current element of queue "from", and it is moved
+// from there to the rear of its (possibly new) level.
+void demotionAndPromotionCheck(Process *curr, Queue *from) {
+
+	Queue *to;
+	int oldLevel;
+
+	applyBoost(curr);
+	oldLevel = curr->inWhichQueue;
 
 	switch(curr->inWhichQueue) {
 
 		case 1:
 			// Demotion of process from Level 1 -> 2
 			// Put at rear.
-			if(curr->b == curr->bLim) {
+			if(demotionDue(curr)) {
 				curr->inWhichQueue++;
 				curr->b = 0;
 				curr->bLim = 2;
@@ -590,18 +947,18 @@ void demotionAndPromotionCheck(Process *curr) {
 				curr->gLim = 1;
 				curr->quantum = 30;
 				curr->quantumRemaining = 30;
-				add_to_queue(&level2, curr, 0);
+				to = &level2;
 			}
 			// Process returns to level 1 at the rear.
 			else {
-				add_to_queue(&level1, curr, 0);
+				to = &level1;
 			}
 			break;
 
 		case 2:
 			// Promotion of process from Level 2 -> 1
 			// Put at rear.
-			if(curr->g == curr->gLim) {
+			if(!allotmentMode && curr->g == curr->gLim) {
 				curr->inWhichQueue--;
 				curr->g = 0;
 				curr->gLim = -1;
@@ -609,11 +966,11 @@ void demotionAndPromotionCheck(Process *curr) {
 				curr->bLim = 1;
 				curr->quantum = 10;
 				curr->quantumRemaining = 10;
-				add_to_queue(&level1, curr, 0);
+				to = &level1;
 			}
 			// Demotion of process from Level 2 -> 3
 			// Put at rear.
-			else if(curr->b == curr->bLim) {
+			else if(demotionDue(curr)) {
 				curr->inWhichQueue++;
 				curr->b = 0;
 				curr->bLim = 2;
@@ -621,18 +978,18 @@ void demotionAndPromotionCheck(Process *curr) {
 				curr->gLim = 2;
 				curr->quantum = 100;
 				curr->quantumRemaining = 100;
-				add_to_queue(&level3, curr, 0);
+				to = &level3;
 			}
 			// Process returns to level 2 at the rear.
 			else {
-				add_to_queue(&level2, curr, 0);
+				to = &level2;
 			}
 			break;
 
 		case 3:
 			// Promotion of process from Level 3 -> 2
 			// Put at rear.
-			if(curr->g == curr->gLim) {
+			if(!allotmentMode && curr->g == curr->gLim) {
 				curr->inWhichQueue--;
 				curr->g = 0;
 				curr->gLim = 1;
@@ -640,11 +997,11 @@ void demotionAndPromotionCheck(Process *curr) {
 				curr->bLim = 2;
 				curr->quantum = 30;
 				curr->quantumRemaining = 30;
-				add_to_queue(&level2, curr, 0);
+				to = &level2;
 			}
 			// Demotion of process form Level 3 -> 4
 			// Put at rear.
-			else if(curr->b == curr->bLim) {
+			else if(demotionDue(curr)) {
 				curr->inWhichQueue++;
 				curr->b = 0;
 				curr->bLim = -1;
@@ -652,18 +1009,18 @@ void demotionAndPromotionCheck(Process *curr) {
 				curr->gLim = 2;
 				curr->quantum = 200;
 				curr->quantumRemaining = 200;
-				add_to_queue(&level4, curr, 0);
+				to = &level4;
 			}
 			// Process returns to level 3 at the rear.
 			else {
-				add_to_queue(&level3, curr, 0);
+				to = &level3;
 			}
 			break;
 
 		case 4:
 			// Promotion of process from Level 4 -> 3
 			// Put at rear.
-			if(curr->g == curr->gLim) {
+			if(!allotmentMode && curr->g == curr->gLim) {
 				curr->inWhichQueue--;
 				curr->g = 0;
 				curr->gLim = 2;
@@ -671,11 +1028,11 @@ void demotionAndPromotionCheck(Process *curr) {
 				curr->bLim = 2;
 				curr->quantum = 100;
 				curr->quantumRemaining = 100;
-				add_to_queue(&level3, curr, 0);
+				to = &level3;
 			}
 			// Process returns to level 4 at the rear.
 			else {
-				add_to_queue(&level4, curr, 0);
+				to = &level4;
 			}
 			break;
 
@@ -687,37 +1044,26 @@ void demotionAndPromotionCheck(Process *curr) {
 
 	}
 
+	if(curr->inWhichQueue != oldLevel) {
+		metricsLevelChange(curr, oldLevel);
+		curr->levelStartCPU = curr->usageCPU;
+		curr->migrations++;
+	}
+	metricsReady(curr);
+	move_handle(to, from, current_handle(from), 0);
+	occupancyChange();
 }
 
 // insertAtRear() inserts process given to the rear of the
 // queue that contains it. Used for demotion counter.
+// The process is at the front of its queue, so this stores its
+// latest values there and rotates the front element to the rear.
 void insertAtRear(Process* toBePutRear) {
-	switch(toBePutRear->inWhichQueue) {
-		case 1:
-			rewind_queue(&level1);
-			add_to_queue(&level1, toBePutRear, 0);
-			delete_current(&level1);
-			break;
-		case 2:
-			rewind_queue(&level2);
-			add_to_queue(&level2, toBePutRear, 0);
-			delete_current(&level2);
-			break;
-		case 3:
-			rewind_queue(&level3);
-			add_to_queue(&level3, toBePutRear, 0);
-			delete_current(&level3);
-			break;
-		case 4:
-			rewind_queue(&level4);
-			add_to_queue(&level4, toBePutRear, 0);
-			delete_current(&level4);
-			break;
-		default:
-			printf("ERROR: Process is lost.\n");
-			exit(0);
-			break;
-	}
+
+	Queue *q = levelQueue(toBePutRear->inWhichQueue);
+	rewind_queue(q);
+	update_current(q, toBePutRear);
+	rotate_queue(q);
 }
 
 // updateValues() updates the values from toBeUpdated to adjustments.
@@ -729,40 +1075,443 @@ void updateValues(Process* toBeUpdated) {
 	Process *adjustments = NULL;
 	switch(toBeUpdated->inWhichQueue) {
 		case 1:
-			adjustments = pointer_to_current(&level1);
+			adjustments = Process_pointer_to_current(&level1);
 			adjustments->burstRemaining = toBeUpdated->burstRemaining;
 			adjustments->b = toBeUpdated->b;
 			adjustments->g = toBeUpdated->g;
 			adjustments->quantumRemaining = toBeUpdated->quantumRemaining;
 			adjustments->usageCPU = toBeUpdated->usageCPU;
+			adjustments->metrics = toBeUpdated->metrics;
+			adjustments->quantum = toBeUpdated->quantum;
+			adjustments->bLim = toBeUpdated->bLim;
+			adjustments->gLim = toBeUpdated->gLim;
+			adjustments->boostEpoch = toBeUpdated->boostEpoch;
+			adjustments->levelStartCPU = toBeUpdated->levelStartCPU;
+			adjustments->migrations = toBeUpdated->migrations;
 			break;
 		case 2:
-			adjustments = pointer_to_current(&level2);
+			adjustments = Process_pointer_to_current(&level2);
 			adjustments->burstRemaining = toBeUpdated->burstRemaining;
 			adjustments->b = toBeUpdated->b;
 			adjustments->g = toBeUpdated->g;
 			adjustments->quantumRemaining = toBeUpdated->quantumRemaining;
 			adjustments->usageCPU = toBeUpdated->usageCPU;
+			adjustments->metrics = toBeUpdated->metrics;
+			adjustments->quantum = toBeUpdated->quantum;
+			adjustments->bLim = toBeUpdated->bLim;
+			adjustments->gLim = toBeUpdated->gLim;
+			adjustments->boostEpoch = toBeUpdated->boostEpoch;
+			adjustments->levelStartCPU = toBeUpdated->levelStartCPU;
+			adjustments->migrations = toBeUpdated->migrations;
 			break;
 		case 3:
-			adjustments = pointer_to_current(&level3);
+			adjustments = Process_pointer_to_current(&level3);
 			adjustments->burstRemaining = toBeUpdated->burstRemaining;
 			adjustments->b = toBeUpdated->b;
 			adjustments->g = toBeUpdated->g;
 			adjustments->quantumRemaining = toBeUpdated->quantumRemaining;
 			adjustments->usageCPU = toBeUpdated->usageCPU;
+			adjustments->metrics = toBeUpdated->metrics;
+			adjustments->quantum = toBeUpdated->quantum;
+			adjustments->bLim = toBeUpdated->bLim;
+			adjustments->gLim = toBeUpdated->gLim;
+			adjustments->boostEpoch = toBeUpdated->boostEpoch;
+			adjustments->levelStartCPU = toBeUpdated->levelStartCPU;
+			adjustments->migrations = toBeUpdated->migrations;
 			break;
 		case 4:
-			adjustments = pointer_to_current(&level4);
+			adjustments = Process_pointer_to_current(&level4);
 			adjustments->burstRemaining = toBeUpdated->burstRemaining;
 			adjustments->b = toBeUpdated->b;
 			adjustments->g = toBeUpdated->g;
 			adjustments->quantumRemaining = toBeUpdated->quantumRemaining;
 			adjustments->usageCPU = toBeUpdated->usageCPU;
+			adjustments->metrics = toBeUpdated->metrics;
+			adjustments->quantum = toBeUpdated->quantum;
+			adjustments->bLim = toBeUpdated->bLim;
+			adjustments->gLim = toBeUpdated->gLim;
+			adjustments->boostEpoch = toBeUpdated->boostEpoch;
+			adjustments->levelStartCPU = toBeUpdated->levelStartCPU;
+			adjustments->migrations = toBeUpdated->migrations;
 			break;
 		default:
 			printf("ERROR: process is lost.\n");
 			exit(0);
 			break;
 	}
-}
\ No newline at end of file
+}
+
+// profileNow() reads the profiling clock: the TSC on x86, otherwise
+// the monotonic clock in nanoseconds.
+unsigned long profileNow() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+#endif
+}
+
+// profileSection() records the time since start against a loop section
+// and returns the current time as the start of the next section.
+// Returns 0 without reading the clock if not profiling.
+unsigned long profileSection(int section, unsigned long start) {
+	if(!profiling) {
+		return 0;
+	}
+	unsigned long now = profileNow();
+	hist_record(&sectionTime[section], now - start);
+	return now;
+}
+
+// profileEvent() records the time since start against an event type.
+void profileEvent(int event, unsigned long start) {
+	if(profiling) {
+		hist_record(&eventTime[event], profileNow() - start);
+	}
+}
+
+// printProfile() prints the section and event histograms to stderr.
+void printProfile() {
+#if defined(__x86_64__) || defined(__i386__)
+	const char *unit = "cycles";
+#else
+	const char *unit = "ns";
+#endif
+	int i;
+	fprintf(stderr, "PROFILE: time per loop iteration in each section (%s):\n", unit);
+	for(i = 0; i < NUM_SECTIONS; i++) {
+		hist_summary(stderr, sectionNames[i], &sectionTime[i]);
+	}
+	fprintf(stderr, "PROFILE: time to handle each event (%s):\n", unit);
+	for(i = 0; i < NUM_EVENTS; i++) {
+		hist_summary(stderr, eventNames[i], &eventTime[i]);
+	}
+	for(i = 0; i < NUM_SECTIONS; i++) {
+		fprintf(stderr, "PROFILE: %s distribution (%s):\n", sectionNames[i], unit);
+		hist_print(stderr, &sectionTime[i], 40);
+	}
+}
+
+// metricsReady() notes that p has just become ready (arrived, been
+// requeued or preempted, or returned from I/O).
+void metricsReady(Process *p) {
+	p->metrics.readySince = schedClock;
+}
+
+// metricsDispatch() accounts for the wait of p, which is starting to
+// run, and its response time if this is its first run.
+void metricsDispatch(Process *p) {
+	unsigned long wait = schedClock - p->metrics.readySince;
+	p->metrics.waitTime += wait;
+	liveStats.levelDispatches[p->inWhichQueue - 1]++;
+	if(metrics) {
+		hist_record(&levelWaitHist[p->inWhichQueue - 1], wait);
+		if(!p->metrics.started) {
+			hist_record(&responseHist, schedClock - p->arrivalTime);
+		}
+	}
+	p->metrics.started = 1;
+}
+
+// metricsLevelChange() accounts for p moving from oldLevel to its
+// current level.
+void metricsLevelChange(Process *p, int oldLevel) {
+	if(metrics) {
+		hist_record(&levelResidencyHist[oldLevel - 1], schedClock - p->metrics.levelSince);
+	}
+	if(p->inWhichQueue > oldLevel) {
+		p->metrics.demotions++;
+		liveStats.levelDemotions[oldLevel - 1]++;
+	}
+	else {
+		p->metrics.promotions++;
+		liveStats.levelPromotions[oldLevel - 1]++;
+	}
+	p->metrics.levelSince = schedClock;
+}
+
+// metricsFinish() records the totals of p, which has just finished.
+void metricsFinish(Process *p) {
+	liveStats.finished++;
+	if(metrics) {
+		hist_record(&levelResidencyHist[p->inWhichQueue - 1], schedClock - p->metrics.levelSince);
+		hist_record(&turnaroundHist, schedClock - p->arrivalTime);
+		hist_record(&waitHist, p->metrics.waitTime);
+		hist_record(&demotionHist, p->metrics.demotions);
+		hist_record(&promotionHist, p->metrics.promotions);
+		hist_record(&preemptionHist, p->metrics.preemptions);
+	}
+}
+
+// printMetrics() prints the latency histograms to stderr.
+void printMetrics() {
+	char name[32];
+	int i;
+	fprintf(stderr, "METRICS: per process (ticks, or counts):\n");
+	hist_summary(stderr, "turnaround", &turnaroundHist);
+	hist_summary(stderr, "response", &responseHist);
+	hist_summary(stderr, "ready-queue wait", &waitHist);
+	hist_summary(stderr, "demotions", &demotionHist);
+	hist_summary(stderr, "promotions", &promotionHist);
+	hist_summary(stderr, "preemptions", &preemptionHist);
+	fprintf(stderr, "METRICS: per level (ticks):\n");
+	for(i = 0; i < 4; i++) {
+		snprintf(name, sizeof(name), "level %d wait", i + 1);
+		hist_summary(stderr, name, &levelWaitHist[i]);
+		snprintf(name, sizeof(name), "level %d residency", i + 1);
+		hist_summary(stderr, name, &levelResidencyHist[i]);
+	}
+}
+
+// occupancyChange() brings the gauge integrals up to the current tick
+// and picks up the new gauge values. Called whenever a queue length or
+// the CPU state may have changed. Changes within one tick only count
+// from the last one, as the integrals advance only between ticks.
+void occupancyChange() {
+	if(!sampleFile) {
+		return;
+	}
+	unsigned long elapsed = schedClock - gaugeSince;
+	for(int i = 0; i < NUM_GAUGES; i++) {
+		gaugeArea[i] += gaugeValue[i] * elapsed;
+	}
+	gaugeSince = schedClock;
+	gaugeValue[GAUGE_LEVEL1] = queue_length(&level1);
+	gaugeValue[GAUGE_LEVEL2] = queue_length(&level2);
+	gaugeValue[GAUGE_LEVEL3] = queue_length(&level3);
+	gaugeValue[GAUGE_LEVEL4] = queue_length(&level4);
+	gaugeValue[GAUGE_BLOCKED] = queue_length(&blocked);
+	gaugeValue[GAUGE_BUSY] = currExecuting.PID != 0;
+}
+
+// takeSample() ends the current interval at schedClock and buffers a
+// row of the time-weighted means over it.
+void takeSample() {
+	unsigned long span = schedClock - lastSample;
+	for(int i = 0; i < NUM_GAUGES; i++) {
+		unsigned long area = gaugeArea[i] + gaugeValue[i] * (schedClock - gaugeSince);
+		sampleMean[i][sampleRows] = (float) (area - sampleArea[i]) / span;
+		sampleArea[i] = area;
+	}
+	sampleTick[sampleRows] = schedClock;
+	sampleRunning[sampleRows] = currExecuting.PID != 0 ? currExecuting.inWhichQueue : 0;
+	sampleRows++;
+	lastSample = schedClock;
+	nextSample = schedClock + sampleInterval;
+	if(sampleRows == SAMPLE_BLOCK) {
+		flushSamples();
+	}
+}
+
+// flushSamples() writes the buffered rows to the sample file as one
+// block.
+void flushSamples() {
+	if(sampleRows == 0) {
+		return;
+	}
+	fwrite(&sampleRows, sizeof(sampleRows), 1, sampleFile);
+	fwrite(sampleTick, sizeof(sampleTick[0]), sampleRows, sampleFile);
+	for(int i = 0; i < NUM_GAUGES; i++) {
+		fwrite(sampleMean[i], sizeof(sampleMean[i][0]), sampleRows, sampleFile);
+	}
+	fwrite(sampleRunning, sizeof(sampleRunning[0]), sampleRows, sampleFile);
+	sampleRows = 0;
+}
+
+// finishSampling() writes the last, partial interval, closes the
+// sample file and prints the time-weighted means over the whole run to
+// stderr.
+void finishSampling() {
+	if(schedClock > lastSample) {
+		takeSample();
+	}
+	flushSamples();
+	if(fclose(sampleFile) != 0) {
+		perror("sample file");
+	}
+	fprintf(stderr, "OCCUPANCY: time-weighted mean over %lu ticks:", schedClock);
+	for(int i = 0; i < NUM_GAUGES; i++) {
+		fprintf(stderr, " %s %.3f", gaugeNames[i], schedClock ? (double) sampleArea[i] / schedClock : 0.0);
+	}
+	fprintf(stderr, "\n");
+}
+
+// liveAttach() creates the shared-memory segment name for -l and
+// maps it. Returns 1 on success, else prints an error and returns 0.
+int liveAttach(const char *name) {
+	int fd;
+	// Start from a fresh segment, in case an old run left one behind.
+	shm_unlink(name);
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if(fd < 0 || ftruncate(fd, sizeof(MLFQSLive)) != 0) {
+		perror(name);
+		return 0;
+	}
+	liveShm = (MLFQSLive *) mmap(NULL, sizeof(MLFQSLive), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(liveShm == MAP_FAILED) {
+		perror(name);
+		liveShm = NULL;
+		return 0;
+	}
+	liveName = name;
+	liveShm->version = MLFQS_LIVE_VERSION;
+	liveShm->pid = getpid();
+	atomic_init(&liveShm->seq, 0);
+	atomic_thread_fence(memory_order_release);
+	liveShm->magic = MLFQS_LIVE_MAGIC;
+	return 1;
+}
+
+// livePublish() fills in the current state and copies liveStats into
+// the segment. done marks the final update.
+void livePublish(int done) {
+	struct timespec ts;
+	int i;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	liveStats.clock = schedClock;
+	liveStats.wallNs = ts.tv_sec * 1000000000UL + ts.tv_nsec;
+	liveStats.nullTicks = nullProc.usageCPU;
+	liveStats.preScheduled = queue_length(&preScheduleProcs);
+	liveStats.blocked = queue_length(&blocked);
+	liveStats.events = liveStats.created + liveStats.finished;
+	for(i = 0; i < 4; i++) {
+		liveStats.levelLength[i] = queue_length(levelQueue(i + 1));
+		liveStats.events += liveStats.levelDispatches[i] + liveStats.levelDemotions[i] +
+			liveStats.levelPromotions[i] + liveStats.levelPreemptions[i];
+	}
+	liveStats.runningPID = currExecuting.PID;
+	liveStats.runningLevel = currExecuting.PID != 0 ? currExecuting.inWhichQueue : 0;
+	liveStats.done = done;
+
+	// Seqlock write: odd while the copy is in progress.
+	unsigned long seq = atomic_load_explicit(&liveShm->seq, memory_order_relaxed);
+	atomic_store_explicit(&liveShm->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	liveShm->stats = liveStats;
+	atomic_store_explicit(&liveShm->seq, seq + 2, memory_order_release);
+}
+
+// boostAll() moves every process to level 1. If the running process
+// is still first in line afterwards, it keeps the CPU and is boosted
+// in place. Otherwise it is preempted and queued with the rest, and
+// the head of level 1 starts in the same tick, as after any
+// preemption. Blocked processes return to level 1 when their I/O
+// completes.
+void boostAll() {
+	unsigned long eventStart = profiling ? profileNow() : 0;
+	int preempted = 0;
+
+	printf("BOOST: All processes moved to level 1 at time %lu.\n", schedClock);
+	if(currExecuting.PID != 0) {
+		// The splices keep the order of the levels, so the head of
+		// level 1 afterwards is the head of the highest ready level now.
+		Queue *first = !empty_queue(&level1) ? &level1 :
+			!empty_queue(&level2) ? &level2 :
+			!empty_queue(&level3) ? &level3 : &level4;
+		rewind_queue(first);
+		preempted = Process_pointer_to_current(first)->PID != currExecuting.PID;
+	}
+	if(preempted) {
+		printf("QUEUED: Process %lu queued at level 1 at time %lu.\n",
+		currExecuting.PID, schedClock);
+		metricsReady(&currExecuting);
+		updateValues(&currExecuting);
+		currExecuting = nullProc;
+	}
+	boostEpoch++;
+	lastBoost = schedClock;
+	// Each level is spliced onto the rear of level 1 in O(1).
+	drain_into(&level1, &level2);
+	drain_into(&level1, &level3);
+	drain_into(&level1, &level4);
+	if(preempted) {
+		grabAReadyProcess(&currExecuting);
+		metricsDispatch(&currExecuting);
+		costDispatch(&currExecuting);
+		printf("RUN: Process %lu started execution from level %d at time %lu; ",
+		currExecuting.PID, currExecuting.inWhichQueue, schedClock);
+		printf("wants to execute for %lu ticks.\n",
+		currExecuting.burstRemaining);
+		profileEvent(EV_PREEMPT, eventStart);
+	}
+	else if(currExecuting.PID != 0) {
+		rewind_queue(&level1);
+		applyBoost(&currExecuting);
+	}
+	occupancyChange();
+}
+
+// applyBoost() resets p to level 1 if a boost happened since it was
+// last brought up to date.
+void applyBoost(Process *p) {
+	if(p->boostEpoch == boostEpoch) {
+		return;
+	}
+	if(metrics && p->inWhichQueue != 1) {
+		hist_record(&levelResidencyHist[p->inWhichQueue - 1], lastBoost - p->metrics.levelSince);
+	}
+	if(p->inWhichQueue != 1) {
+		p->metrics.levelSince = lastBoost;
+		p->migrations++;
+	}
+	p->inWhichQueue = 1;
+	p->b = 0;
+	p->g = 0;
+	p->bLim = 1;
+	p->gLim = -1;
+	p->quantum = 10;
+	p->quantumRemaining = 10;
+	p->levelStartCPU = p->usageCPU;
+	p->boostEpoch = boostEpoch;
+}
+
+// allotmentSpent() returns 1 if, in allotment mode, p has used up the
+// CPU allotment of its level, else 0.
+int allotmentSpent(Process *p) {
+	unsigned long allotment = levelAllotment[p->inWhichQueue - 1];
+	return allotmentMode && allotment != 0 && p->usageCPU - p->levelStartCPU >= allotment;
+}
+
+// demotionDue() applies the demotion rule to p: its level's allotment
+// is used up with -A, else it used its whole quantum "b" times.
+int demotionDue(Process *p) {
+	if(allotmentMode) {
+		return allotmentSpent(p);
+	}
+	return p->b == p->bLim;
+}
+
+// costDispatch() charges the overhead of dispatching p under -C.
+void costDispatch(Process *p) {
+	if(!costModel) {
+		return;
+	}
+	overheadLeft[COST_SWITCH] = costTicks[COST_SWITCH];
+	overheadLeft[COST_REFILL] = lastRunPID != 0 && lastRunPID != p->PID ? costTicks[COST_REFILL] : 0;
+	overheadLeft[COST_MIGRATION] = p->migrations * costTicks[COST_MIGRATION];
+	p->migrations = 0;
+	lastRunPID = p->PID;
+}
+
+// overheadPending() returns 1 if the current dispatch still has
+// overhead ticks to spend, else 0.
+int overheadPending() {
+	return costModel && (overheadLeft[COST_SWITCH] || overheadLeft[COST_REFILL] ||
+		overheadLeft[COST_MIGRATION]);
+}
+
+// consumeOverhead() spends one tick of the current dispatch's
+// overhead, switch first, then refill, then migration.
+void consumeOverhead() {
+	int i;
+	for(i = 0; i < NUM_COSTS; i++) {
+		if(overheadLeft[i] > 0) {
+			overheadLeft[i]--;
+			overheadUsed[i]++;
+			return;
+		}
+	}
+}
@@ -0,0 +1,344 @@
+//
+// Microbenchmarks for prioque.c.  Measures ns/op for the main queue
+// operations across queue sizes and element sizes, and throughput of
+// the locked and nolock paths with 1 to 64 threads.  Results are
+// written to stdout as JSON, for regression tracking.
+//
+// Usage: bench-prioque [-n max_queue_size] [-e max_element_size]
+//                      [-t max_threads] [-m memory_limit_MB]
+//
+// Queue sizes run from 10 up to 'max_queue_size' (default and at most
+// 10^7) in powers of 10.  Element sizes are 8, 64, 256 and
+// 1024 bytes, up to 'max_element_size'.  Thread counts are powers of
+// 2 up to 'max_threads' (default 64).  Combinations that would need
+// more than 'memory_limit_MB' (default 4096) of queue elements are
+// skipped.
+//
+// Operations that cost O(n) each on a queue of size n (prioritized
+// add, element_in_queue) are timed over a bounded number of calls on
+// a queue prefilled to size n.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "prioque.h"
+
+#define MAX_QUEUE_SIZE 10000000UL
+#define ELEMENT_OVERHEAD 64		// rough per-element cost beyond the data
+#define SCAN_BUDGET 10000000UL		// element visits allowed per O(n) measurement
+#define THREAD_OPS 200000UL		// operations per thread in contention tests
+#define BATCH 16			// operations per lock_queue() in batched tests
+
+static int first_result = TRUE;
+
+
+// returns the current time in ns
+static double now_ns(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+// deterministic pseudo-random numbers
+static unsigned long rng(unsigned long *state) {
+
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+
+// elements compare equal if their leading 8 bytes (the key) match
+static int key_compare(const void *e1, const void *e2) {
+
+  return memcmp(e1, e2, sizeof(unsigned long)) != 0;
+}
+
+
+// legacy serialize_queue() element writer
+static int write_element(void *element, int *priority, FILE *fp, StateSerialization mode) {
+
+  (void) mode;
+  return fwrite(element, sizeof(unsigned long), 1, fp) == 1 &&
+    fwrite(priority, sizeof(int), 1, fp) == 1;
+}
+
+
+static void report(const char *op, unsigned long size, unsigned int elementsize,
+		   unsigned int threads, unsigned long ops, double ns) {
+
+  printf("%s\n    {\"op\": \"%s\", \"queue_size\": %lu, \"element_size\": %u, "
+	 "\"threads\": %u, \"ops\": %lu, \"ns_per_op\": %.2f}",
+	 first_result ? "" : ",", op, size, elementsize, threads, ops, ops ? ns / ops : 0.0);
+  first_result = FALSE;
+  fflush(stdout);
+}
+
+
+// fill 'q' with 'n' elements whose keys are 0..n-1.  Priorities are
+// non-increasing, so prioritized queues are filled in O(n).
+static void fill(Queue *q, char *element, unsigned long n) {
+
+  unsigned long i;
+
+  for (i = 0; i < n; i++) {
+    memcpy(element, &i, sizeof(i));
+    add_to_queue(q, element, -(int) (i / 16));
+  }
+}
+
+
+// single-threaded benchmarks for one queue size and element size
+static void bench_ops(unsigned long n, unsigned int elementsize) {
+
+  Queue q, q2;
+  char *element;
+  unsigned long i, k, seed = 0x2545F4914F6CDD1DUL;
+  double t;
+  FILE *devnull;
+
+  element = (char *) calloc(1, elementsize);
+  if (element == NULL) {
+    fprintf(stderr, "calloc() failed in bench_ops()\n");
+    exit(1);
+  }
+
+  // bounded number of calls for operations that scan the queue
+  k = SCAN_BUDGET / n;
+  if (k < 1) {
+    k = 1;
+  }
+  if (k > n) {
+    k = n;
+  }
+
+  // add to a FIFO queue
+  init_queue(&q, elementsize, TRUE, key_compare, TRUE);
+  t = now_ns();
+  fill(&q, element, n);
+  report("add_fifo", n, elementsize, 1, n, now_ns() - t);
+
+  // remove_from_front
+  t = now_ns();
+  for (i = 0; i < n; i++) {
+    remove_from_front(&q, element);
+  }
+  report("remove_from_front", n, elementsize, 1, n, now_ns() - t);
+
+  // delete_current
+  fill(&q, element, n);
+  rewind_queue(&q);
+  t = now_ns();
+  for (i = 0; i < n; i++) {
+    delete_current(&q);
+  }
+  report("delete_current", n, elementsize, 1, n, now_ns() - t);
+
+  // element_in_queue, for random keys in a queue of size n
+  fill(&q, element, n);
+  t = now_ns();
+  for (i = 0; i < k; i++) {
+    unsigned long key = rng(&seed) % n;
+    memcpy(element, &key, sizeof(key));
+    element_in_queue(&q, element);
+  }
+  report("element_in_queue", n, elementsize, 1, k, now_ns() - t);
+
+  // copy_queue, per element copied
+  init_queue(&q2, elementsize, TRUE, key_compare, TRUE);
+  t = now_ns();
+  copy_queue(&q2, &q);
+  report("copy_queue", n, elementsize, 1, n, now_ns() - t);
+  destroy_queue(&q2);
+
+  // save_queue and legacy serialize_queue, per element written
+  devnull = fopen("/dev/null", "w");
+  if (devnull) {
+    t = now_ns();
+    save_queue(&q, devnull);
+    report("save_queue", n, elementsize, 1, n, now_ns() - t);
+    t = now_ns();
+    serialize_queue(&q, write_element, devnull);
+    report("serialize_queue", n, elementsize, 1, n, now_ns() - t);
+    fclose(devnull);
+  }
+  destroy_queue(&q);
+
+  // add to a prioritized queue of size n, random priorities
+  init_queue(&q, elementsize, TRUE, key_compare, FALSE);
+  fill(&q, element, n);
+  t = now_ns();
+  for (i = 0; i < k; i++) {
+    add_to_queue(&q, element, -(int) (rng(&seed) % (n / 16 + 1)));
+  }
+  report("add_prioritized", n, elementsize, 1, k, now_ns() - t);
+  destroy_queue(&q);
+
+  // merge two prioritized queues of size n, per element merged
+  init_queue(&q, elementsize, TRUE, key_compare, FALSE);
+  init_queue(&q2, elementsize, TRUE, key_compare, FALSE);
+  fill(&q, element, n);
+  fill(&q2, element, n);
+  t = now_ns();
+  merge_queues(&q, &q2);
+  report("merge_queues", n, elementsize, 1, n, now_ns() - t);
+  destroy_queue(&q);
+  destroy_queue(&q2);
+
+  free(element);
+}
+
+
+// shared state for the contention benchmarks
+static Queue shared_q;
+
+typedef struct {
+  int mode;
+  Queue private_q;
+} Worker;
+
+enum { LOCKED, BATCHED, PRIVATE };
+
+static void *worker(void *arg) {
+
+  Worker *w = (Worker *) arg;
+  unsigned long i, j, e = 0;
+
+  switch (w->mode) {
+  case LOCKED:
+    // one lock round trip per operation on a shared queue
+    for (i = 0; i < THREAD_OPS / 2; i++) {
+      add_to_queue(&shared_q, &e, 0);
+      remove_from_front(&shared_q, &e);
+    }
+    break;
+  case BATCHED:
+    // BATCH nolock operations per lock round trip on a shared queue
+    for (i = 0; i < THREAD_OPS / BATCH; i++) {
+      lock_queue(&shared_q);
+      for (j = 0; j < BATCH / 2; j++) {
+	nolock_add_to_queue(&shared_q, &e, 0);
+	nolock_nosync_remove_from_front(&shared_q, &e);
+      }
+      unlock_queue(&shared_q);
+    }
+    break;
+  case PRIVATE:
+    // nolock operations on a queue private to the thread
+    for (i = 0; i < THREAD_OPS / 2; i++) {
+      nolock_add_to_queue(&(w->private_q), &e, 0);
+      nolock_nosync_remove_from_front(&(w->private_q), &e);
+    }
+    break;
+  }
+
+  return NULL;
+}
+
+
+// multi-threaded benchmarks with 'nthreads' threads
+static void bench_threads(unsigned int nthreads) {
+
+  static const char *names[] = { "contention_locked", "contention_nolock_batched",
+				 "contention_nolock_private" };
+  pthread_t *threads;
+  Worker *workers;
+  unsigned int i;
+  int mode;
+  double t;
+
+  threads = (pthread_t *) malloc(nthreads * sizeof(pthread_t));
+  workers = (Worker *) malloc(nthreads * sizeof(Worker));
+  if (threads == NULL || workers == NULL) {
+    fprintf(stderr, "malloc() failed in bench_threads()\n");
+    exit(1);
+  }
+
+  for (mode = LOCKED; mode <= PRIVATE; mode++) {
+    init_queue(&shared_q, sizeof(unsigned long), TRUE, NULL, TRUE);
+    for (i = 0; i < nthreads; i++) {
+      workers[i].mode = mode;
+      init_queue(&(workers[i].private_q), sizeof(unsigned long), TRUE, NULL, TRUE);
+    }
+    t = now_ns();
+    for (i = 0; i < nthreads; i++) {
+      pthread_create(&threads[i], NULL, worker, &workers[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+      pthread_join(threads[i], NULL);
+    }
+    // ns per operation of aggregate throughput
+    report(names[mode], 0, sizeof(unsigned long), nthreads,
+	   (unsigned long) nthreads * THREAD_OPS, now_ns() - t);
+    for (i = 0; i < nthreads; i++) {
+      destroy_queue(&(workers[i].private_q));
+    }
+    destroy_queue(&shared_q);
+  }
+
+  free(threads);
+  free(workers);
+}
+
+
+int main(int argc, char *argv[]) {
+
+  static const unsigned int elementsizes[] = { 8, 64, 256, 1024 };
+  unsigned long max_size = MAX_QUEUE_SIZE, memory_limit = 4096, n;
+  unsigned int max_elementsize = 1024, max_threads = 64, threads, i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:e:t:m:")) != -1) {
+    switch (opt) {
+    case 'n':
+      max_size = strtoul(optarg, NULL, 10);
+      break;
+    case 'e':
+      max_elementsize = (unsigned int) strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      max_threads = (unsigned int) strtoul(optarg, NULL, 10);
+      break;
+    case 'm':
+      memory_limit = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n max_queue_size] [-e max_element_size] "
+	      "[-t max_threads] [-m memory_limit_MB]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (max_size > MAX_QUEUE_SIZE) {
+    max_size = MAX_QUEUE_SIZE;
+  }
+
+  printf("{\n  \"benchmark\": \"prioque\",\n  \"results\": [");
+
+  for (i = 0; i < sizeof(elementsizes) / sizeof(elementsizes[0]); i++) {
+    if (elementsizes[i] > max_elementsize) {
+      continue;
+    }
+    for (n = 10; n <= max_size; n *= 10) {
+      // merge_queues holds three queues of size n at once
+      if (3 * n * (elementsizes[i] + ELEMENT_OVERHEAD) > memory_limit * 1024 * 1024) {
+	break;
+      }
+      bench_ops(n, elementsizes[i]);
+    }
+  }
+
+  for (threads = 1; threads <= max_threads; threads *= 2) {
+    bench_threads(threads);
+  }
+
+  printf("\n  ]\n}\n");
+
+  return 0;
+}
@@ -0,0 +1,153 @@
+//
+// Fixed-size log-linear histograms.  See histogram.h.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include "histogram.h"
+
+// rows of hist_print(): one for 0 and one per power of 2
+#define HIST_ROWS (sizeof(unsigned long) * 8 + 1)
+
+// function prototypes for internal functions
+static unsigned long bucket_high(unsigned int bucket);
+static unsigned int value_row(unsigned long value);
+
+
+void hist_init(Histogram *h) {
+
+  memset(h, 0, sizeof(Histogram));
+}
+
+
+void hist_merge(Histogram *to, const Histogram *from) {
+
+  unsigned int i;
+
+  if (from->total == 0) {
+    return;
+  }
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    to->counts[i] += from->counts[i];
+  }
+  if (to->total == 0 || from->min < to->min) {
+    to->min = from->min;
+  }
+  if (from->max > to->max) {
+    to->max = from->max;
+  }
+  to->total += from->total;
+  to->sum += from->sum;
+}
+
+
+unsigned long hist_percentile(const Histogram *h, double percentile) {
+
+  unsigned long rank, seen = 0, high;
+  unsigned int i;
+
+  if (h->total == 0) {
+    return 0;
+  }
+  if (percentile <= 0.0) {
+    return h->min;
+  }
+
+  // smallest rank covering 'percentile' of the values
+  rank = (unsigned long) (percentile / 100.0 * h->total);
+  if ((double) rank < percentile / 100.0 * h->total) {
+    rank++;
+  }
+  if (rank > h->total) {
+    rank = h->total;
+  }
+
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen >= rank) {
+      high = bucket_high(i);
+      return high < h->max ? high : h->max;
+    }
+  }
+
+  return h->max;
+}
+
+
+double hist_mean(const Histogram *h) {
+
+  return h->total ? h->sum / h->total : 0.0;
+}
+
+
+void hist_summary(FILE *fp, const char *name, const Histogram *h) {
+
+  fprintf(fp, "%-28s count %10lu  mean %12.1f  p50 %10lu  p90 %10lu  p99 %10lu  p99.9 %10lu  max %10lu\n",
+	  name, h->total, hist_mean(h), hist_percentile(h, 50.0), hist_percentile(h, 90.0),
+	  hist_percentile(h, 99.0), hist_percentile(h, 99.9), h->max);
+}
+
+
+void hist_print(FILE *fp, const Histogram *h, int width) {
+
+  unsigned long rows[HIST_ROWS], largest = 0;
+  unsigned int i, first = HIST_ROWS, last = 0;
+  int bar;
+
+  if (h->total == 0) {
+    return;
+  }
+
+  memset(rows, 0, sizeof(rows));
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    if (h->counts[i]) {
+      // buckets never straddle a power of 2
+      rows[value_row(bucket_high(i))] += h->counts[i];
+    }
+  }
+
+  for (i = 0; i < HIST_ROWS; i++) {
+    if (rows[i]) {
+      if (i < first) {
+	first = i;
+      }
+      last = i;
+      if (rows[i] > largest) {
+	largest = rows[i];
+      }
+    }
+  }
+
+  for (i = first; i <= last; i++) {
+    unsigned long low = i == 0 ? 0 : 1UL << (i - 1);
+    unsigned long high = i == 0 ? 0 : low + (low - 1);
+    bar = (int) ((double) rows[i] / largest * width + 0.5);
+    fprintf(fp, "  %20lu .. %-20lu %10lu  %.*s\n", low, high, rows[i], bar,
+	    "################################################################"
+	    "################################################################");
+  }
+}
+
+
+// returns the largest value that falls into 'bucket'
+static unsigned long bucket_high(unsigned int bucket) {
+
+  unsigned int shift;
+  unsigned long sub;
+
+  if (bucket < 2 * HIST_SUB_BUCKETS) {
+    return bucket;
+  }
+  shift = bucket / HIST_SUB_BUCKETS - 1;
+  sub = bucket - shift * HIST_SUB_BUCKETS;
+  // wraps to ULONG_MAX for the last bucket
+  return ((sub + 1) << shift) - 1;
+}
+
+
+// returns the hist_print() row for 'value': 0 for 0, otherwise 1 +
+// the position of its highest set bit
+static unsigned int value_row(unsigned long value) {
+
+  return value == 0 ? 0 : (unsigned int) (sizeof(unsigned long) * 8 - __builtin_clzl(value));
+}
@@ -0,0 +1,85 @@
+//
+// Fixed-size log-linear histograms in the style of HdrHistogram.
+//
+// Values from 0 to ULONG_MAX are recorded with a relative error of at
+// most 1/HIST_SUB_BUCKETS (about 3%).  Values below
+// 2 * HIST_SUB_BUCKETS are recorded exactly.  Above that, each power of
+// 2 is split into HIST_SUB_BUCKETS equal sub-buckets.
+//
+// A Histogram is a plain struct with no pointers, so recording never
+// allocates and histograms can be declared statically, embedded in
+// other structs, copied and merged.
+//
+
+#if ! defined(HISTOGRAM_H)
+#define HISTOGRAM_H
+
+#include <stdio.h>
+
+// log2 of the number of sub-buckets per power of 2
+#define HIST_SUB_BITS 5
+#define HIST_SUB_BUCKETS (1UL << HIST_SUB_BITS)
+
+// enough buckets for any unsigned long
+#define HIST_BUCKETS ((sizeof(unsigned long) * 8 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+typedef struct Histogram {
+  unsigned long counts[HIST_BUCKETS];                // # of values recorded in each bucket
+  unsigned long total;                               // # of values recorded
+  unsigned long min;                                 // smallest value recorded
+  unsigned long max;                                 // largest value recorded
+  double sum;                                        // sum of values recorded, for the mean
+} Histogram;
+
+// empties 'h'.
+void hist_init(Histogram *h);
+
+// records 'value' in 'h'.
+static inline void hist_record(Histogram *h, unsigned long value);
+
+// adds every value recorded in 'from' to 'to'.
+void hist_merge(Histogram *to, const Histogram *from);
+
+// returns the value at or below which 'percentile' percent (0 to 100)
+// of the values in 'h' fall, to within the precision of 'h'.  Returns
+// 0 if 'h' is empty.
+unsigned long hist_percentile(const Histogram *h, double percentile);
+
+// returns the mean of the values in 'h', or 0 if 'h' is empty.
+double hist_mean(const Histogram *h);
+
+// prints one line to 'fp' summarizing 'h' under 'name': count, mean,
+// p50, p90, p99, p99.9 and max.
+void hist_summary(FILE *fp, const char *name, const Histogram *h);
+
+// prints the distribution of 'h' to 'fp', one row per power of 2
+// range holding values, with a bar of up to 'width' characters.
+void hist_print(FILE *fp, const Histogram *h, int width);
+
+
+// returns the bucket holding 'value'
+static inline unsigned int hist_bucket(unsigned long value) {
+
+  unsigned int shift;
+
+  if (value < 2 * HIST_SUB_BUCKETS) {
+    return (unsigned int) value;
+  }
+  shift = (unsigned int) (sizeof(unsigned long) * 8 - 1 - __builtin_clzl(value)) - HIST_SUB_BITS;
+  return shift * HIST_SUB_BUCKETS + (unsigned int) (value >> shift);
+}
+
+static inline void hist_record(Histogram *h, unsigned long value) {
+
+  h->counts[hist_bucket(value)]++;
+  if (h->total == 0 || value < h->min) {
+    h->min = value;
+  }
+  if (value > h->max) {
+    h->max = value;
+  }
+  h->total++;
+  h->sum += (double) value;
+}
+
+#endif
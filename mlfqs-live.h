@@ -0,0 +1,50 @@
+//
+// Live statistics that MLFQS publishes in shared memory (MLFQS -l),
+// read by mlfqs-top.
+//
+// The simulator is the only writer.  It never waits for readers: each
+// update makes 'seq' odd, copies in a new MLFQSLiveStats and makes
+// 'seq' even again.  A reader copies the stats out and retries if
+// 'seq' was odd or changed meanwhile (a seqlock).
+//
+
+#if ! defined(MLFQS_LIVE_H)
+#define MLFQS_LIVE_H
+
+#include <stdatomic.h>
+
+#define MLFQS_LIVE_MAGIC 0x4D4C4651534C4956UL          // set once the segment is ready
+#define MLFQS_LIVE_VERSION 1
+#define MLFQS_LIVE_DEFAULT_NAME "/mlfqs-live"
+
+// one consistent view of the simulation
+typedef struct MLFQSLiveStats {
+  unsigned long clock;                               // scheduler clock
+  unsigned long wallNs;                              // CLOCK_MONOTONIC time of this update
+  unsigned long events;                              // arrivals, dispatches, preemptions, level changes, exits
+  unsigned long created;                             // processes arrived
+  unsigned long finished;                            // processes terminated
+  unsigned long nullTicks;                           // ticks of the <<null>> process
+  unsigned long preScheduled;                        // processes yet to arrive
+  unsigned long blocked;                             // processes doing I/O
+  unsigned long levelLength[4];                      // processes ready at each level
+  unsigned long levelDispatches[4];                  // RUNs from each level
+  unsigned long levelRunTicks[4];                    // CPU ticks used at each level
+  unsigned long levelDemotions[4];                   // moves down out of each level
+  unsigned long levelPromotions[4];                  // moves up out of each level
+  unsigned long levelPreemptions[4];                 // preemptions of processes at each level
+  unsigned long runningPID;                          // 0 if idle
+  int runningLevel;                                  // 0 if idle
+  int done;                                          // set by the final update
+} MLFQSLiveStats;
+
+// the shared-memory segment
+typedef struct MLFQSLive {
+  unsigned long magic;                               // MLFQS_LIVE_MAGIC once initialized
+  unsigned int version;                              // MLFQS_LIVE_VERSION
+  int pid;                                           // process id of the simulator
+  atomic_ulong seq;                                  // odd while an update is in progress
+  MLFQSLiveStats stats;
+} MLFQSLive;
+
+#endif
@@ -0,0 +1,144 @@
+//
+// top-style viewer for the live statistics of a running MLFQS
+// simulation (MLFQS -l NAME, see mlfqs-live.h).
+//
+// Usage: mlfqs-top [-n NAME] [-d delay_ms] [-1]
+//
+// Attaches read-only to the shared-memory segment NAME (default
+// /mlfqs-live) and redraws the screen every 'delay_ms' (default 1000)
+// until the simulation finishes.  Rates are computed from the change
+// since the previous screen.  With -1, prints one plain snapshot and
+// exits.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "mlfqs-live.h"
+
+// copies a consistent snapshot of the stats in 'live' to 'stats'
+static void read_stats(MLFQSLive *live, MLFQSLiveStats *stats) {
+
+  unsigned long seq1, seq2;
+
+  for (;;) {
+    seq1 = atomic_load_explicit(&(live->seq), memory_order_acquire);
+    if (seq1 & 1) {
+      // update in progress
+      sched_yield();
+      continue;
+    }
+    memcpy(stats, &(live->stats), sizeof(MLFQSLiveStats));
+    atomic_thread_fence(memory_order_acquire);
+    seq2 = atomic_load_explicit(&(live->seq), memory_order_relaxed);
+    if (seq1 == seq2) {
+      return;
+    }
+  }
+}
+
+
+// per-second rate of change from 'before' to 'after' over 'ns'
+static double rate(unsigned long before, unsigned long after, unsigned long ns) {
+
+  return ns ? (after - before) * 1e9 / ns : 0.0;
+}
+
+
+static void show(const MLFQSLiveStats *s, const MLFQSLiveStats *prev, int pid) {
+
+  unsigned long ns = s->wallNs - prev->wallNs;
+  int i;
+
+  printf("MLFQS pid %d  %s  clock %lu  ticks/s %.0f  events/s %.0f\n",
+	 pid, s->done ? "FINISHED" : "running", s->clock,
+	 rate(prev->clock, s->clock, ns), rate(prev->events, s->events, ns));
+  printf("processes: created %lu  finished %lu  not yet arrived %lu  blocked %lu\n",
+	 s->created, s->finished, s->preScheduled, s->blocked);
+  printf("cpu: null ticks %lu (%.1f%%)  running ",
+	 s->nullTicks, s->clock ? 100.0 * s->nullTicks / s->clock : 0.0);
+  if (s->runningPID) {
+    printf("PID %lu at level %d\n", s->runningPID, s->runningLevel);
+  }
+  else {
+    printf("<<null>>\n");
+  }
+  printf("\n%-6s %8s %12s %12s %10s %10s %11s\n",
+	 "level", "ready", "dispatches", "run ticks", "demotions", "promotions", "preemptions");
+  for (i = 0; i < 4; i++) {
+    printf("%-6d %8lu %12lu %12lu %10lu %10lu %11lu\n", i + 1, s->levelLength[i],
+	   s->levelDispatches[i], s->levelRunTicks[i], s->levelDemotions[i],
+	   s->levelPromotions[i], s->levelPreemptions[i]);
+  }
+  fflush(stdout);
+}
+
+
+int main(int argc, char *argv[]) {
+
+  const char *name = MLFQS_LIVE_DEFAULT_NAME;
+  long delay_ms = 1000;
+  int once = 0, opt, fd;
+  MLFQSLive *live;
+  MLFQSLiveStats stats, prev;
+  struct timespec delay;
+
+  while ((opt = getopt(argc, argv, "n:d:1")) != -1) {
+    switch (opt) {
+    case 'n':
+      name = optarg;
+      break;
+    case 'd':
+      delay_ms = strtol(optarg, NULL, 10);
+      break;
+    case '1':
+      once = 1;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n NAME] [-d delay_ms] [-1]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+    perror(name);
+    return 1;
+  }
+  live = (MLFQSLive *) mmap(NULL, sizeof(MLFQSLive), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (live == MAP_FAILED) {
+    perror(name);
+    return 1;
+  }
+  if (live->magic != MLFQS_LIVE_MAGIC || live->version != MLFQS_LIVE_VERSION) {
+    fprintf(stderr, "%s: not an MLFQS live statistics segment\n", name);
+    return 1;
+  }
+
+  // the segment is read-only here, so 'seq' is only ever loaded
+  read_stats(live, &prev);
+  if (once) {
+    show(&prev, &prev, live->pid);
+    return 0;
+  }
+
+  delay.tv_sec = delay_ms / 1000;
+  delay.tv_nsec = (delay_ms % 1000) * 1000000L;
+  do {
+    nanosleep(&delay, NULL);
+    read_stats(live, &stats);
+    // clear the screen and home the cursor
+    printf("\033[H\033[J");
+    show(&stats, &prev, live->pid);
+    prev = stats;
+  } while (! stats.done);
+
+  munmap(live, sizeof(MLFQSLive));
+
+  return 0;
+}
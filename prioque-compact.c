@@ -0,0 +1,68 @@
+//
+// Folds a chain of prioque delta snapshots into a single full
+// snapshot (see save_queue_snapshot() in prioque.h).
+//
+// Usage: prioque-compact OUTPUT BASE [DELTA ...]
+//
+// BASE is a full snapshot and each DELTA must continue from the epoch
+// of the snapshot before it.  OUTPUT receives a full snapshot of the
+// final state, which can serve as the base for later deltas.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "prioque.h"
+
+int main(int argc, char *argv[]) {
+
+  Queue q;
+  FILE *fp;
+  unsigned int elementsize;
+  int i;
+
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s OUTPUT BASE [DELTA ...]\n", argv[0]);
+    return 2;
+  }
+
+  if ((fp = fopen(argv[2], "rb")) == NULL) {
+    perror(argv[2]);
+    return 1;
+  }
+  if ((elementsize = queue_snapshot_elementsize(fp)) == 0) {
+    fprintf(stderr, "%s: not a queue snapshot\n", argv[2]);
+    return 1;
+  }
+
+  // the snapshots place every element explicitly, so a FIFO queue
+  // keeps them exactly where they were
+  init_queue(&q, elementsize, TRUE, NULL, TRUE);
+  track_queue_changes(&q);
+
+  for (i = 2; i < argc; i++) {
+    if (i > 2 && (fp = fopen(argv[i], "rb")) == NULL) {
+      perror(argv[i]);
+      return 1;
+    }
+    if (! apply_queue_snapshot(&q, fp)) {
+      fprintf(stderr, "%s: could not apply snapshot\n", argv[i]);
+      return 1;
+    }
+    fclose(fp);
+  }
+
+  if ((fp = fopen(argv[1], "wb")) == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  if (! save_queue_snapshot(&q, fp, TRUE) || fclose(fp) != 0) {
+    fprintf(stderr, "%s: write failed\n", argv[1]);
+    return 1;
+  }
+
+  printf("%s: %lu elements from %d snapshot(s)\n", argv[1], queue_length(&q), argc - 2);
+
+  destroy_queue(&q);
+
+  return 0;
+}
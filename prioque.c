@@ -8,32 +8,596 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include "prioque.h"
 
-#define QUEUE_MAGIC 0xC0FFEEC0FFEE
-
-// global lock on entire package
-pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LF_QUEUE_MAGIC 0xFEEDC0FFEEF0
+#define SHARDED_QUEUE_MAGIC 0xFEEDBEEFC0DE
+#define QUEUE_ARENA_MAGIC 0xFEEDFACEC0DE
+
+// huge page size assumed when rounding arena chunks
+#define QUEUE_ARENA_HUGE_PAGE (2UL * 1024 * 1024)
+
+// arena allocations are aligned for any type
+#define ARENA_ALIGN(n) \
+  (((n) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+// each element of a shard is stored behind a ticket recording its
+// place in the sharded queue's global arrival order
+#define SHARD_TICKET_SIZE sizeof(unsigned long)
+
+// elements up to this size are staged on the stack when added to a
+// sharded queue
+#define SHARD_STAGING_SIZE 256
+
+// initial # of buckets in the hash index of a hashed queue
+#define QUEUE_INITIAL_BUCKETS 64
+
+// element data is stored directly after the element, suitably aligned
+#define ELEMENT_HEADER_SIZE \
+  ((sizeof(struct _Queue_element) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+// queue file layout, see save_queue()
+#define QUEUE_FILE_HEADER_SIZE 48
+#define QUEUE_FILE_RECORD_HEADER 8
+#define QUEUE_FILE_RECORD_SIZE(elementsize) \
+  (QUEUE_FILE_RECORD_HEADER + (((elementsize) + 7) & ~7UL))
+
+// snapshot file layout, see save_queue_snapshot()
+#define QUEUE_SNAPSHOT_HEADER_SIZE 64
+#define QUEUE_SNAPSHOT_RECORD_HEADER 24
+#define QUEUE_SNAPSHOT_RECORD_SIZE(elementsize) \
+  (QUEUE_SNAPSHOT_RECORD_HEADER + (((elementsize) + 7) & ~7UL))
+
+// save_queue() and load_queue() move data in blocks of about this size
+#define QUEUE_FILE_BUFFER_SIZE (1024 * 1024)
+
+// largest set of queues lock_queues() handles without malloc()
+#define LOCK_QUEUES_ON_STACK 16
+
+// The queue length is atomic so empty_queue() and queue_length() can
+// read it without the queue lock.  It is only ever written with the
+// queue lock held, so writers use a plain load and a release store
+// rather than an atomic read-modify-write.  The release store is made
+// after the list itself has been updated.
+#define LENGTH(q) atomic_load_explicit(&((q)->queuelength), memory_order_relaxed)
+#if defined(PRIOQUE_STATS)
+#define SET_LENGTH(q, n)						\
+  do {									\
+    unsigned long length_ = (n);					\
+    atomic_store_explicit(&((q)->queuelength), length_, memory_order_release); \
+    if (length_ > (q)->stats.peak_length) {				\
+      (q)->stats.peak_length = length_;				\
+    }									\
+  } while (0)
+#else
+#define SET_LENGTH(q, n) atomic_store_explicit(&((q)->queuelength), (n), memory_order_release)
+#endif
 
 // for init purposes
 pthread_mutex_t initial_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t initial_cond = PTHREAD_COND_INITIALIZER;
+
+// source of element ids for change tracking; unique across queues
+static atomic_ulong next_element_id = 1;
+
+// hands out a distinct shard affinity to each thread that uses a
+// sharded queue
+static atomic_uint next_shard_thread = 0;
+static _Thread_local unsigned int shard_thread = UINT_MAX;
+
+#if defined(PRIOQUE_STATS)
+// one queue registered with report_queue_stats()
+typedef struct _Stats_report {
+  Queue *q;                                          // NULL once the queue is destroyed
+  const char *name;
+  Queue_stats stats;                                 // final counters of a destroyed queue
+  struct _Stats_report *next;
+} Stats_report;
+
+static Stats_report *stats_reports = NULL;
+static pthread_mutex_t stats_reports_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 // function prototypes for internal functions
+static void index_insert(Queue *q, Queue_element e);
+static void index_remove(Queue *q, Queue_element e);
+static Queue_element find_element(Queue *q, void *element);
+static void link_element(Queue *q, Queue_element e, Queue_element after);
+static void unlink_element(Queue *q, Queue_element e);
+static void check_watermarks(Queue *q);
+static Queue_action apply_update(Queue *q, Queue_element e, Queue_updater fn, void *ctx,
+				 Queue_element *pending, Queue_element *pending_tail);
+static void deadline_after(struct timespec *deadline, long timeout_ms);
+static Queue_element insertion_point(Queue *q, int priority);
+static Queue_element advance_insertion_point(Queue *q, Queue_element prev, int priority);
+static Queue_element alloc_element(Queue *q, void *element, int priority);
+static void free_element(Queue *q, Queue_element e);
+static int same_allocator(Queue *q1, Queue *q2);
+static Queue_element transfer_element(Queue *to, Queue *from, Queue_element e);
+static unsigned long splice_all(Queue *to, Queue *from);
+static void clone_into(Queue *q1, Queue *q2);
+static void lock_two_queues(Queue *q1, Queue *q2);
+static void unlock_two_queues(Queue *q1, Queue *q2);
+static void log_removal(Queue *q, Queue_element e);
+#if defined(PRIOQUE_STATS)
+static void detach_stats_report(Queue *q);
+static void dump_stats_at_exit(void);
+#endif
 
 
 void init_queue(Queue *q, unsigned int elementsize, unsigned int duplicates,
 	   int (*compare) (const void *e1, const void *e2), unsigned int priority_is_tag_only) {
 
   q->magic = QUEUE_MAGIC;
-  q->queuelength = 0;
+  atomic_init(&(q->queuelength), 0);
   q->elementsize = elementsize;
   q->queue = NULL;
   q->tail = NULL;
   q->duplicates = duplicates;
   q->compare = compare;
   q->priority_is_tag_only = priority_is_tag_only;
+  q->hash = NULL;
+  q->buckets = NULL;
+  q->nbuckets = 0;
+  q->allocator.alloc = NULL;
+  q->allocator.release = NULL;
+  q->allocator.ctx = NULL;
+  q->freelist = NULL;
   nolock_rewind_queue(q);
   q->lock = initial_mutex;
+  q->nonempty = initial_cond;
+  q->waiters = 0;
+  q->wakeups = 0;
+  q->closed = FALSE;
+  q->capacity = 0;
+  q->notfull = initial_cond;
+  q->full_waiters = 0;
+  q->high_watermark = 0;
+  q->low_watermark = 0;
+  q->watermark = NULL;
+  q->watermark_ctx = NULL;
+  q->above_watermark = FALSE;
+  q->hold_watermarks = FALSE;
+  q->track_changes = FALSE;
+  q->epoch = 0;
+  q->removed = NULL;
+  q->nremoved = 0;
+  q->removed_size = 0;
+#if defined(PRIOQUE_STATS)
+  memset(&(q->stats), 0, sizeof(Queue_stats));
+#endif
+}
+
+
+void init_queue_hashed(Queue *q, unsigned int elementsize, unsigned int duplicates,
+		       int (*compare) (const void *e1, const void *e2),
+		       unsigned long (*hash) (const void *e),
+		       unsigned int priority_is_tag_only) {
+
+  if (! compare || ! hash) {
+    fprintf(stderr, "prioque.c: init_queue_hashed() requires both a comparison and a hash function.\n");
+    exit(1);
+  }
+
+  init_queue(q, elementsize, duplicates, compare, priority_is_tag_only);
+  q->hash = hash;
+}
+
+
+// add 'e' to the hash index of 'q', growing the index if the load
+// factor would exceed 1.  'e->hash' must already be set.
+static void index_insert(Queue *q, Queue_element e) {
+
+  Queue_element *buckets, ptr, next;
+  unsigned long i, nbuckets;
+
+  if (q->buckets == NULL || LENGTH(q) > q->nbuckets) {
+    nbuckets = q->buckets ? q->nbuckets * 2 : QUEUE_INITIAL_BUCKETS;
+    buckets = (Queue_element *) calloc(nbuckets, sizeof(Queue_element));
+    if (buckets == NULL) {
+      fprintf(stderr, "calloc() failed in function index_insert()\n");
+      exit(1);
+    }
+    // rehash existing chains into the larger table
+    for (i = 0; i < q->nbuckets; i++) {
+      for (ptr = q->buckets[i]; ptr != NULL; ptr = next) {
+	next = ptr->hnext;
+	ptr->hnext = buckets[ptr->hash & (nbuckets - 1)];
+	buckets[ptr->hash & (nbuckets - 1)] = ptr;
+      }
+    }
+    free(q->buckets);
+    q->buckets = buckets;
+    q->nbuckets = nbuckets;
+  }
+
+  i = e->hash & (q->nbuckets - 1);
+  e->hnext = q->buckets[i];
+  q->buckets[i] = e;
+}
+
+
+// remove 'e' from the hash index of 'q'
+static void index_remove(Queue *q, Queue_element e) {
+
+  Queue_element *link;
+
+  link = &(q->buckets[e->hash & (q->nbuckets - 1)]);
+  while (*link != e) {
+    link = &((*link)->hnext);
+  }
+  *link = e->hnext;
+  e->hnext = NULL;
+}
+
+
+// return the first element of 'q' matching 'element' (via the hash
+// index if 'q' is hashed), or NULL if there is no match
+static Queue_element find_element(Queue *q, void *element) {
+
+  Queue_element ptr;
+  unsigned long h;
+
+  if (q->hash) {
+    if (q->buckets == NULL) {
+      return NULL;
+    }
+    h = q->hash(element);
+    for (ptr = q->buckets[h & (q->nbuckets - 1)]; ptr != NULL; ptr = ptr->hnext) {
+      PRIOQUE_STAT(q, scan_steps);
+      if (ptr->hash == h && (PRIOQUE_STAT(q, compares), q->compare(element, ptr->info) == 0)) {
+	return ptr;
+      }
+    }
+  }
+  else {
+    for (ptr = q->queue; ptr != NULL; ptr = ptr->next) {
+      PRIOQUE_STAT(q, scan_steps);
+      PRIOQUE_STAT(q, compares);
+      if (q->compare(element, ptr->info) == 0) {
+	return ptr;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+
+// link 'e' into 'q' immediately after 'after', or at the front of the
+// queue if 'after' is NULL.  Maintains the tail, length and hash index.
+static void link_element(Queue *q, Queue_element e, Queue_element after) {
+
+  if (after == NULL) {
+    e->next = q->queue;
+    q->queue = e;
+  }
+  else {
+    e->next = after->next;
+    after->next = e;
+  }
+  e->prev = after;
+
+  if (e->next == NULL) {
+    // new tail
+    q->tail = e;
+  }
+  else {
+    e->next->prev = e;
+  }
+
+  SET_LENGTH(q, LENGTH(q) + 1);
+  PRIOQUE_STAT(q, adds);
+
+  if (q->hash) {
+    index_insert(q, e);
+  }
+
+  if (q->track_changes) {
+    if (e->id == 0) {
+      e->id = atomic_fetch_add_explicit(&next_element_id, 1, memory_order_relaxed);
+    }
+    e->epoch = q->epoch;
+  }
+
+  if (q->waiters) {
+    pthread_cond_signal(&(q->nonempty));
+  }
+
+  if (q->watermark && ! q->hold_watermarks) {
+    check_watermarks(q);
+  }
+}
+
+
+// call the watermark callback of 'q' if its length has crossed the
+// high or low watermark.  Operations that unlink elements only to
+// relink them set 'hold_watermarks' meanwhile and check once at the
+// end, so a length that ends where it started fires nothing.
+static void check_watermarks(Queue *q) {
+
+  unsigned long length = LENGTH(q);
+
+  if (! q->above_watermark && length >= q->high_watermark) {
+    q->above_watermark = TRUE;
+    q->watermark(q, TRUE, q->watermark_ctx);
+  }
+  else if (q->above_watermark && length <= q->low_watermark) {
+    q->above_watermark = FALSE;
+    q->watermark(q, FALSE, q->watermark_ctx);
+  }
+}
+
+
+// set 'deadline' to 'timeout_ms' milliseconds from now, for
+// pthread_cond_timedwait()
+static void deadline_after(struct timespec *deadline, long timeout_ms) {
+
+  clock_gettime(CLOCK_REALTIME, deadline);
+  deadline->tv_sec += timeout_ms / 1000;
+  deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+  if (deadline->tv_nsec >= 1000000000L) {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000L;
+  }
+}
+
+
+// return the element after which a new element with 'priority'
+// belongs in 'q', or NULL if it belongs at the front.  FIFO queues
+// always add at the rear.  Prioritized queues use strict 'to the rear'
+// placement among equal priorities, so the scan runs backwards from
+// the tail.
+static Queue_element insertion_point(Queue *q, int priority) {
+
+  Queue_element prev = q->tail;
+
+  if (! q->priority_is_tag_only) {
+    while (prev != NULL && priority > prev->priority) {
+      PRIOQUE_STAT(q, scan_steps);
+      prev = prev->prev;
+    }
+  }
+
+  return prev;
+}
+
+
+// starting from 'prev' (or the front of 'q' if 'prev' is NULL), move
+// forward to the element after which a new element with 'priority'
+// belongs.  Used to merge runs of non-increasing priority into a
+// prioritized queue in a single pass.
+static Queue_element advance_insertion_point(Queue *q, Queue_element prev, int priority) {
+
+  Queue_element next = prev ? prev->next : q->queue;
+
+  while (next != NULL && priority <= next->priority) {
+    PRIOQUE_STAT(q, scan_steps);
+    prev = next;
+    next = next->next;
+  }
+
+  return prev;
+}
+
+
+// allocate a new, unlinked element for 'q' holding a copy of
+// 'element' (uninitialized if 'element' is NULL).  The element data
+// shares a single allocation with the element itself.
+static Queue_element alloc_element(Queue *q, void *element, int priority) {
+
+  Queue_element e;
+
+  if (q->freelist) {
+    e = q->freelist;
+    q->freelist = e->next;
+  }
+  else if (q->allocator.alloc) {
+    PRIOQUE_STAT(q, allocs);
+    e = (Queue_element) q->allocator.alloc(ELEMENT_HEADER_SIZE + q->elementsize, q->allocator.ctx);
+    if (e == NULL) {
+      fprintf(stderr, "Queue allocator failed in function add_to_queue()\n");
+      exit(1);
+    }
+  }
+  else {
+    PRIOQUE_STAT(q, allocs);
+    e = (Queue_element) malloc(ELEMENT_HEADER_SIZE + q->elementsize);
+    if (e == NULL) {
+      fprintf(stderr, "malloc() failed in function add_to_queue()\n");
+      exit(1);
+    }
+  }
+
+  e->info = (char *) e + ELEMENT_HEADER_SIZE;
+  if (element) {
+    memcpy(e->info, element, q->elementsize);
+  }
+  e->priority = priority;
+  e->hash = q->hash && element ? q->hash(element) : 0;
+  e->hnext = NULL;
+  e->id = 0;
+  e->epoch = 0;
+
+  return e;
+}
+
+
+// release an element allocated by alloc_element().  Elements of a
+// queue whose allocator can't release single elements are recycled.
+static void free_element(Queue *q, Queue_element e) {
+
+  if (q->allocator.alloc == NULL) {
+    PRIOQUE_STAT(q, frees);
+    free(e);
+  }
+  else if (q->allocator.release) {
+    PRIOQUE_STAT(q, frees);
+    q->allocator.release(e, q->allocator.ctx);
+  }
+  else {
+    e->next = q->freelist;
+    q->freelist = e;
+  }
+}
+
+
+// returns TRUE if elements of 'q1' and 'q2' come from the same
+// allocator and so can be relinked from one queue to the other.
+static int same_allocator(Queue *q1, Queue *q2) {
+
+  return q1->allocator.alloc == q2->allocator.alloc &&
+    q1->allocator.release == q2->allocator.release &&
+    q1->allocator.ctx == q2->allocator.ctx;
+}
+
+
+// prepare unlinked element 'e' of 'from' to be linked into 'to'.  If
+// the queues use different allocators, 'e' is copied into storage
+// from the allocator of 'to' and released.  Returns the element to
+// link.
+static Queue_element transfer_element(Queue *to, Queue *from, Queue_element e) {
+
+  Queue_element copy;
+
+  if (same_allocator(to, from)) {
+    e->hash = to->hash ? to->hash(e->info) : 0;
+    return e;
+  }
+
+  copy = alloc_element(to, e->info, e->priority);
+  free_element(from, e);
+  return copy;
+}
+
+
+// move every element of 'from' to the rear of 'to' in O(1) by
+// relinking the two lists.  Only valid if 'to' has no hash index,
+// allows duplicates, and the elements of 'from' belong after the
+// tail of 'to'.  Returns the number of elements moved.
+static unsigned long splice_all(Queue *to, Queue *from) {
+
+  unsigned long n = LENGTH(from);
+
+  if (from->queue == NULL) {
+    return 0;
+  }
+
+  from->queue->prev = to->tail;
+  if (to->tail == NULL) {
+    to->queue = from->queue;
+  }
+  else {
+    to->tail->next = from->queue;
+  }
+  to->tail = from->tail;
+  SET_LENGTH(to, LENGTH(to) + n);
+
+  if (to->waiters) {
+    pthread_cond_broadcast(&(to->nonempty));
+  }
+
+  from->queue = NULL;
+  from->tail = NULL;
+  SET_LENGTH(from, 0);
+
+  if (from->full_waiters) {
+    pthread_cond_broadcast(&(from->notfull));
+  }
+
+  if (to->watermark) {
+    check_watermarks(to);
+  }
+  if (from->watermark) {
+    check_watermarks(from);
+  }
+
+  // stale bucket chains in 'from' must not be reused
+  free(from->buckets);
+  from->buckets = NULL;
+  from->nbuckets = 0;
+
+  return n;
+}
+
+
+// add a copy of every element of 'q2' to 'q1' in a single pass.  A
+// prioritized 'q2' is already in queue order, so for a prioritized
+// 'q1' the insertion point only moves forward.
+static void clone_into(Queue *q1, Queue *q2) {
+
+  Queue_element ptr, prev = NULL;
+
+  for (ptr = q2->queue; ptr != NULL; ptr = ptr->next) {
+    if (! q1->duplicates) {
+      nolock_add_to_queue(q1, ptr->info, ptr->priority);
+      continue;
+    }
+    if (! q1->priority_is_tag_only && ! q2->priority_is_tag_only) {
+      prev = advance_insertion_point(q1, prev, ptr->priority);
+    }
+    else {
+      prev = insertion_point(q1, ptr->priority);
+    }
+    link_element(q1, alloc_element(q1, ptr->info, ptr->priority), prev);
+    prev = prev ? prev->next : q1->queue;
+  }
+}
+
+
+// unlink 'e' from 'q' without freeing it.  If 'e' is the current
+// element, the current position moves to the following element, as
+// for delete_current().
+static void unlink_element(Queue *q, Queue_element e) {
+
+  if (e == q->current) {
+    q->current = e->next;
+  }
+  if (e == q->previous) {
+    q->previous = e->prev;
+  }
+
+  if (e->prev == NULL) {
+    q->queue = e->next;
+  }
+  else {
+    e->prev->next = e->next;
+  }
+
+  if (e->next == NULL) {
+    // new tail
+    q->tail = e->prev;
+  }
+  else {
+    e->next->prev = e->prev;
+  }
+
+  e->next = e->prev = NULL;
+  SET_LENGTH(q, LENGTH(q) - 1);
+  PRIOQUE_STAT(q, removes);
+
+  if (q->hash) {
+    index_remove(q, e);
+  }
+
+  if (q->track_changes) {
+    log_removal(q, e);
+  }
+
+  if (q->full_waiters) {
+    pthread_cond_signal(&(q->notfull));
+  }
+
+  if (q->watermark && ! q->hold_watermarks) {
+    check_watermarks(q);
+  }
 }
 
 
@@ -51,8 +615,12 @@ void destroy_queue(Queue *q) {
     exit(1);
   }
 
+#if defined(PRIOQUE_STATS)
+  detach_stats_report(q);
+#endif
+
   // lock entire queue
-  pthread_mutex_lock(&(q->lock));
+  PRIOQUE_LOCK(q);
 
   nolock_destroy_queue(q);
 
@@ -71,12 +639,32 @@ void nolock_destroy_queue(Queue *q) {
   }
 
   if (q != NULL) {
+    if (q->allocator.alloc && ! q->allocator.release) {
+      // element storage belongs to the allocator as a whole
+      q->queue = NULL;
+      q->freelist = NULL;
+    }
     while (q->queue != NULL) {
-      free(q->queue->info);
       temp = q->queue;
       q->queue = q->queue->next;
-      free(temp);
-      (q->queuelength)--;
+      free_element(q, temp);
+    }
+    q->tail = NULL;
+    SET_LENGTH(q, 0);
+    free(q->buckets);
+    q->buckets = NULL;
+    q->nbuckets = 0;
+    // destroying a queue ends change tracking
+    free(q->removed);
+    q->removed = NULL;
+    q->nremoved = 0;
+    q->removed_size = 0;
+    q->track_changes = FALSE;
+    if (q->full_waiters) {
+      pthread_cond_broadcast(&(q->notfull));
+    }
+    if (q->watermark && ! q->hold_watermarks) {
+      check_watermarks(q);
     }
   }
 
@@ -86,29 +674,23 @@ void nolock_destroy_queue(Queue *q) {
 
 unsigned int nolock_element_in_queue(Queue *q, void *element) {
 
-  unsigned int found = FALSE;
+  Queue_element match;
   
   if (q->magic != QUEUE_MAGIC) {
     fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_element_in_queue() **\n");
     exit(1);
   }
   
-  if (q->queue != NULL) {
-    nolock_rewind_queue(q);
-    while (! nolock_end_of_queue(q) && ! found) {
-      if (q->compare(element, q->current->info) == 0) {
-	found = TRUE;
-      }
-      else {
-	nolock_next_element(q);
-      }
-    }
+  match = find_element(q, element);
+  if (match) {
+    q->current = match;
+    q->previous = match->prev;
   }
-  if (! found) {
+  else {
     nolock_rewind_queue(q);
   }
 
-  return found;
+  return match != NULL;
 }
 
 
@@ -122,7 +704,7 @@ unsigned int element_in_queue(Queue *q, void *element) {
   }
   
   // lock entire queue
-  pthread_mutex_lock(&(q->lock));
+  PRIOQUE_LOCK(q);
 
   found = nolock_element_in_queue(q, element);
 
@@ -147,9 +729,6 @@ int nolock_delete_from_queue(Queue *q, void *element) {
     nolock_delete_current(q);
   }
 
-  // release lock on queue
-  pthread_mutex_unlock(&(q->lock));
-
   return found;
 }
 
@@ -164,7 +743,7 @@ int delete_from_queue(Queue *q, void *element) {
   }
   
   // lock entire queue
-  pthread_mutex_lock(&(q->lock));
+  PRIOQUE_LOCK(q);
 
   found = nolock_delete_from_queue(q, element);
 
@@ -184,7 +763,7 @@ void add_to_queue(Queue *q, void *element, int priority) {
   }
 
   // lock entire queue
-  pthread_mutex_lock(&(q->lock));
+  PRIOQUE_LOCK(q);
 
   nolock_add_to_queue(q, element, priority);
 
@@ -196,13 +775,45 @@ void add_to_queue(Queue *q, void *element, int priority) {
 
 void nolock_add_to_queue(Queue *q, void *element, int priority) {
 
-  Queue_element new_element, ptr, prev = NULL;
-  
   if (q->magic != QUEUE_MAGIC) {
     fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_add_to_queue() **\n");
     exit(1);
   }
 
+  nolock_add_to_queue_handle(q, element, priority);
+}
+
+
+Queue_element add_to_queue_handle(Queue *q, void *element, int priority) {
+
+  Queue_element h;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c add_to_queue_handle() **\n");
+    exit(1);
+  }
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  h = nolock_add_to_queue_handle(q, element, priority);
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+
+  return h;
+}
+
+
+Queue_element nolock_add_to_queue_handle(Queue *q, void *element, int priority) {
+
+  Queue_element new_element = NULL;
+  
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_add_to_queue_handle() **\n");
+    exit(1);
+  }
+
   if (! q->duplicates && ! q->compare) {
     fprintf(stderr, "prioque.c: If duplicates are disallowed, the comparison function must be\nspecified in init_queue().\n");
     exit(1);
@@ -211,53 +822,8 @@ void nolock_add_to_queue(Queue *q, void *element, int priority) {
   if (! q->queue ||
      (q->queue && (q->duplicates || ! nolock_element_in_queue(q, element)))) {
 
-    new_element = (Queue_element) malloc(sizeof(struct _Queue_element));
-    if (new_element == NULL) {
-      fprintf(stderr, "malloc() failed in function add_to_queue()\n");
-      exit(1);
-    }
-    new_element->info = (void *)malloc(q->elementsize);
-    if (new_element->info == NULL) {
-      fprintf(stderr, "malloc() failed in function add_to_queue()\n");
-      exit(1);
-    }
-
-    memcpy(new_element->info, element, q->elementsize);
-    new_element->priority = priority;
-    (q->queuelength)++;
-
-    if (q->queue == NULL) {             // first element            
-      new_element->next = NULL;
-      q->queue = new_element;
-      q->tail = new_element;
-    }
-    else if (q->priority_is_tag_only) { // FIFO queue
-      new_element->next = NULL;
-      q->tail->next = new_element;  
-      q->tail = new_element;
-    }
-    else {                              // priority queue
-      ptr = q->queue;
-      while (ptr != NULL && priority <= ptr->priority) {
-	prev = ptr;
-	ptr = ptr->next;
-      }
-
-      if (! prev) {   // queue had only one element and new element
-		      // has higher priority
-	new_element->next = q->queue;
-	q->tail = q->queue;
-	q->queue = new_element;
-      }
-      else {         // insert new element 
-	new_element->next = prev->next;
-	prev->next = new_element;
-	if (new_element->next == NULL) {
-	  // new tail
-	  q->tail = new_element;
-	}
-      }
-    }
+    new_element = alloc_element(q, element, priority);
+    link_element(q, new_element, insertion_point(q, priority));
     
     nolock_rewind_queue(q);
 
@@ -271,478 +837,467 @@ void nolock_add_to_queue(Queue *q, void *element, int priority) {
     //	      printf("---------------\n");
 	
   }
-}
 
+  return new_element;
+}
 
-unsigned int empty_queue(Queue *q) {
 
-  unsigned int ret;
+void *pointer_to_handle(Queue_element h) {
 
-  if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c empty_queue() **\n");
+#if defined(CONSISTENCY_CHECKING)
+  if (h == NULL) {
+    fprintf(stderr, "NULL handle in function pointer_to_handle()\n");
     exit(1);
   }
-  
-  pthread_mutex_lock(&(q->lock));
-  
-  ret = nolock_empty_queue(q);
-
-  pthread_mutex_unlock(&(q->lock));
+#endif
 
-  return ret;
+  return h->info;
 }
 
 
-int nolock_empty_queue(Queue *q) {
+void delete_handle(Queue *q, Queue_element h) {
 
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_empty_queue() **\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c delete_handle() **\n");
     exit(1);
   }
-  
-  return (q->queue == NULL);
-
-}
-
-
-void *remove_from_front(Queue *q, void *element) {
-
-  void *ret = NULL;
 
-  if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c remove_from_front() **\n");
-    exit(1);
-  }
-  
   // lock entire queue
-  pthread_mutex_lock(&(q->lock));
+  PRIOQUE_LOCK(q);
 
-  ret = nolock_nosync_remove_from_front(q, element);
+  nolock_delete_handle(q, h);
 
   // release lock on queue
   pthread_mutex_unlock(&(q->lock));
-
-  return ret;
 }
 
 
-void *remove_from_front_sync(Queue *q, void *element, 
-			     atomic_uint *j, int change) {
-
-  void *ret = NULL;
+void nolock_delete_handle(Queue *q, Queue_element h) {
 
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c remove_from_front_sync() **\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_delete_handle() **\n");
     exit(1);
   }
-  
-  // lock entire queue
-  pthread_mutex_lock(&(q->lock));
-  
-  ret = nolock_nosync_remove_from_front(q, element);
-  
-  if (ret) {
-    if (change >= 0) {
-      atomic_fetch_add(j, change);
-    }
-    else {
-      atomic_fetch_sub(j, change * -1);
-    }
+
+#if defined(CONSISTENCY_CHECKING)
+  if (h == NULL) {
+    fprintf(stderr, "NULL handle in function delete_handle()\n");
+    exit(1);
   }
-  
-  // release lock on queue
-  pthread_mutex_unlock(&(q->lock));
-  
-  return ret;
+#endif
+
+  unlink_element(q, h);
+  free_element(q, h);
 }
 
 
-void *nolock_nosync_remove_from_front(Queue *q, void *element) {
+Queue_element move_handle(Queue *to, Queue *from, Queue_element h, int priority) {
 
-  Queue_element temp;
-  void *ret = NULL;
+  Queue_element ret;
 
-  if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_nosync_remove_from_front() **\n");
+  if (to->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** FIRST QUEUE NOT INITIALIZED in prioque.c move_handle() **\n");
     exit(1);
   }
-  
-  if (q->queue) {
-    memcpy(element, q->queue->info, q->elementsize);
-    ret = element;
-    free(q->queue->info);
-    temp = q->queue;
-    q->queue = q->queue->next;
-    free(temp);
-    (q->queuelength)--;
-    if (q->queue == NULL || q->queue->next == NULL) {
-      // new tail
-      q->tail = q->queue;
-    }
+
+  if (from->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** SECOND QUEUE NOT INITIALIZED in prioque.c move_handle() **\n");
+    exit(1);
   }
 
-  nolock_rewind_queue(q);
+  // lock entire queues to, from.  Locks are always taken in address
+  // order, so concurrent multi-queue operations can't deadlock.
+  lock_two_queues(to, from);
+
+  ret = nolock_move_handle(to, from, h, priority);
+
+  // release locks on to, from
+  unlock_two_queues(to, from);
 
-  //  if (ret) {
-  //    printf("REMOVED %p from queue %p\n", *((unsigned long *)ret), q);
-  //    
-  //    printf("Queue %p now contains:\n", q);
-  //    Queue_element ptr=q->queue;
-  //    while (ptr) {
-  //      printf("-->%p\n", *((unsigned long *)ptr->info));
-  //      ptr = ptr->next;
-  //    }
-  //    printf("---------------\n");
-  //  }
-  
   return ret;
 }
 
 
-void *peek_at_current(Queue *q, void *element, int *priority) {
-
-  void *ret = NULL;
+Queue_element nolock_move_handle(Queue *to, Queue *from, Queue_element h, int priority) {
 
-  if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c peek_at_current() **\n");
+  if (to->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** FIRST QUEUE NOT INITIALIZED in prioque.c nolock_move_handle() **\n");
     exit(1);
   }
 
-  // lock entire queue
-  pthread_mutex_lock(&(q->lock));
-
-  ret = nolock_peek_at_current(q, element, priority);
-
-  // release lock on queue
-  pthread_mutex_unlock(&(q->lock));
+  if (from->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** SECOND QUEUE NOT INITIALIZED in prioque.c nolock_move_handle() **\n");
+    exit(1);
+  }
 
-  return ret;
-}
+#if defined(CONSISTENCY_CHECKING)
+  if (h == NULL) {
+    fprintf(stderr, "NULL handle in function move_handle()\n");
+    exit(1);
+  }
+#endif
 
+  if (to->elementsize != from->elementsize) {
+    fprintf(stderr, "prioque.c: move_handle() requires queues with the same element size.\n");
+    exit(1);
+  }
 
-void *nolock_peek_at_current(Queue *q, void *element, int *priority) {
+  if (! to->duplicates && ! to->compare) {
+    fprintf(stderr, "prioque.c: If duplicates are disallowed, the comparison function must be\nspecified in init_queue().\n");
+    exit(1);
+  }
 
-  void *ret = NULL;
+  // a move within one queue only repositions 'h'
+  from->hold_watermarks = (to == from);
+  unlink_element(from, h);
 
-  if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_peek_at_current() **\n");
-    exit(1);
+  if (to->queue && ! to->duplicates && nolock_element_in_queue(to, h->info)) {
+    // duplicates are silently deleted
+    free_element(from, h);
+    h = NULL;
   }
-  
-  if (q->queue && q->current) {
-    memcpy(element, (q->current)->info, q->elementsize);
-    ret = element;
-    if (priority) {
-      *priority = (q->current)->priority;
+  else {
+    h = transfer_element(to, from, h);
+    h->priority = priority;
+    link_element(to, h, insertion_point(to, priority));
+    nolock_rewind_queue(to);
+  }
+
+  if (from->hold_watermarks) {
+    from->hold_watermarks = FALSE;
+    if (from->watermark) {
+      check_watermarks(from);
     }
   }
-  
-  return ret;
-}
 
+  return h;
+}
 
-void *pointer_to_current(Queue *q) {
 
-  void *data = NULL;
+void rotate_queue(Queue *q) {
 
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c pointer_to_current() **\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c rotate_queue() **\n");
     exit(1);
   }
 
   // lock entire queue
-  pthread_mutex_lock(&(q->lock));
+  PRIOQUE_LOCK(q);
+
+  nolock_rotate_queue(q);
 
-  data = nolock_pointer_to_current(q);
-  
   // release lock on queue
   pthread_mutex_unlock(&(q->lock));
-  
-  return data;
 }
 
 
-void *nolock_pointer_to_current(Queue *q) {
+void nolock_rotate_queue(Queue *q) {
 
-  void *data = NULL;
+  Queue_element front;
 
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_pointer_to_current() **\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_rotate_queue() **\n");
     exit(1);
   }
-  
-  if (q->queue && q->current) {
-    data = (q->current)->info;
+
+  front = q->queue;
+  if (front && front != q->tail) {
+    q->hold_watermarks = TRUE;
+    unlink_element(q, front);
+    link_element(q, front, insertion_point(q, front->priority));
+    q->hold_watermarks = FALSE;
   }
-  
-  return data;
+
+  nolock_rewind_queue(q);
 }
 
 
-int current_priority(Queue *q) {
-  
-  int priority;
+unsigned long add_many(Queue *q, void *elements, int *priorities, unsigned long n) {
+
+  unsigned long added;
 
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c current_priority() **\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c add_many() **\n");
     exit(1);
   }
-  
+
   // lock entire queue
-  pthread_mutex_lock(&(q->lock));
-  
-  priority = nolock_current_priority(q);
-  
+  PRIOQUE_LOCK(q);
+
+  added = nolock_add_many(q, elements, priorities, n);
+
   // release lock on queue
   pthread_mutex_unlock(&(q->lock));
-  
-  return priority;
+
+  return added;
 }
 
 
-int nolock_current_priority(Queue *q) {
+unsigned long nolock_add_many(Queue *q, void *elements, int *priorities, unsigned long n) {
+
+  Queue_element e, prev = NULL;
+  unsigned long i, added = 0;
+  int sorted = TRUE, priority;
 
-  int priority;
-  
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_current_priority() **\n");
-    exit(1);
-  }
-  
-#if defined(CONSISTENCY_CHECKING)
-  if (q->queue == NULL || q->current == NULL) {
-    fprintf(stderr, "NULL pointer in function current_priority()\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_add_many() **\n");
     exit(1);
   }
-  else
-#endif
-  {
 
-    priority = (q->current)->priority;
-    
-    return priority;
+  if (! q->duplicates) {
+    // every element needs a duplicate check against the queue,
+    // including the part of the batch already added
+    for (i = 0; i < n; i++) {
+      if (nolock_add_to_queue_handle(q, (char *) elements + i * q->elementsize,
+				     priorities ? priorities[i] : 0)) {
+	added++;
+      }
+    }
+    return added;
   }
-}
 
- 
- void nolock_update_current(Queue *q, void *element) {
-   
-   if (q->magic != QUEUE_MAGIC) {
-     fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_update_current() **\n");
-     exit(1);
-   }
-   
-#if defined(CONSISTENCY_CHECKING)
-   if (q->queue == NULL || q->current == NULL) {
-    fprintf(stderr, "NULL pointer in function update_current()\n");
-    exit(1);
-   }
-   else
-#endif
-     {
-       memcpy(q->current->info, element, q->elementsize);
-     }
- }
- 
- 
-void update_current(Queue *q, void *element) {
+  if (priorities && ! q->priority_is_tag_only) {
+    for (i = 1; i < n && sorted; i++) {
+      sorted = priorities[i] <= priorities[i - 1];
+    }
+  }
 
-  if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c update_current() **\n");
-    exit(1);
+  for (i = 0; i < n; i++) {
+    priority = priorities ? priorities[i] : 0;
+    e = alloc_element(q, (char *) elements + i * q->elementsize, priority);
+    if (sorted && ! q->priority_is_tag_only) {
+      // batch is in queue order, so the insertion point only moves
+      // forward
+      prev = advance_insertion_point(q, prev, priority);
+    }
+    else {
+      prev = insertion_point(q, priority);
+    }
+    link_element(q, e, prev);
+    prev = e;
+    added++;
   }
-  
-  // lock entire queue
-  pthread_mutex_lock(&(q->lock));
 
-  nolock_update_current(q, element);
+  nolock_rewind_queue(q);
 
-  // release lock on queue
-  pthread_mutex_unlock(&(q->lock));
+  return added;
 }
 
 
-void delete_current(Queue *q) {
+unsigned long remove_up_to_n(Queue *q, void *elements, int *priorities, unsigned long n) {
+
+  unsigned long removed;
 
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c delete_current() **\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c remove_up_to_n() **\n");
     exit(1);
   }
 
   // lock entire queue
-  pthread_mutex_lock(&(q->lock));
+  PRIOQUE_LOCK(q);
 
-  nolock_delete_current(q);
+  removed = nolock_remove_up_to_n(q, elements, priorities, n);
 
   // release lock on queue
   pthread_mutex_unlock(&(q->lock));
 
+  return removed;
 }
 
 
-void nolock_delete_current(Queue *q) {
+unsigned long nolock_remove_up_to_n(Queue *q, void *elements, int *priorities, unsigned long n) {
 
   Queue_element temp;
-  
-  if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_delete_current() **\n");
-    exit(1);
-  }
+  unsigned long removed = 0;
 
-  #if defined(CONSISTENCY_CHECKING)
-  if (q->queue == NULL || q->current == NULL) {
-    fprintf(stderr, "NULL pointer in prioque function delete_current()\n");
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_remove_up_to_n() **\n");
     exit(1);
   }
-  else
-#endif
-  {
-
-    free(q->current->info);
-    temp = q->current;
 
-    if (q->previous == NULL) {	// deletion at beginning
-      q->queue = q->queue->next;
-      q->current = q->queue;
-      if (q->queue == NULL || q->queue->next == NULL) {
-	// new tail
-	q->tail = q->queue;
-      }
-    }
-    else {			// internal deletion 
-      q->previous->next = q->current->next;
-      q->current = q->previous->next;
-      if (q->current == NULL || q->current->next == NULL) {
-	// new tail
-	q->tail = q->current;
-      }
+  while (removed < n && q->queue) {
+    temp = q->queue;
+    memcpy((char *) elements + removed * q->elementsize, temp->info, q->elementsize);
+    if (priorities) {
+      priorities[removed] = temp->priority;
     }
+    unlink_element(q, temp);
+    free_element(q, temp);
+    removed++;
+  }
 
-    free(temp);
-    (q->queuelength)--;
+  nolock_rewind_queue(q);
 
-  }
+  return removed;
 }
 
 
-unsigned int end_of_queue(Queue *q) {
+unsigned long drain_into(Queue *to, Queue *from) {
 
-  unsigned int ret;
+  unsigned long moved;
 
-  if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c end_of_queue() **\n");
+  if (to->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** FIRST QUEUE NOT INITIALIZED in prioque.c drain_into() **\n");
     exit(1);
   }
 
-  // lock entire queue
-  pthread_mutex_lock(&(q->lock));
+  if (from->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** SECOND QUEUE NOT INITIALIZED in prioque.c drain_into() **\n");
+    exit(1);
+  }
 
-  ret = nolock_end_of_queue(q);
+  if (to == from) {
+    return 0;
+  }
 
-  // release lock on queue
-  pthread_mutex_unlock(&(q->lock));
+  // lock entire queues to, from.  Locks are always taken in address
+  // order, so concurrent multi-queue operations can't deadlock.
+  lock_two_queues(to, from);
 
-  return ret;
+  moved = nolock_drain_into(to, from);
+
+  // release locks on to, from
+  unlock_two_queues(to, from);
+
+  return moved;
 }
 
-unsigned int nolock_end_of_queue(Queue *q) {
 
-  if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c delete_current() **\n");
-    exit(1);
+unsigned long nolock_drain_into(Queue *to, Queue *from) {
+
+  Queue_element e, prev = NULL;
+  unsigned long moved = 0;
+
+  if (to->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** FIRST QUEUE NOT INITIALIZED in prioque.c nolock_drain_into() **\n");
+    exit(1);
   }
-  
-  return (q->current == NULL);
-}
 
+  if (from->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** SECOND QUEUE NOT INITIALIZED in prioque.c nolock_drain_into() **\n");
+    exit(1);
+  }
 
-void next_element(Queue *q) {
+  if (to == from) {
+    return 0;
+  }
 
-  if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c next_element() **\n");
+  if (to->elementsize != from->elementsize) {
+    fprintf(stderr, "prioque.c: drain_into() requires queues with the same element size.\n");
     exit(1);
   }
 
-  // lock entire queue
-  pthread_mutex_lock(&(q->lock));
+  if (! to->duplicates && ! to->compare) {
+    fprintf(stderr, "prioque.c: If duplicates are disallowed, the comparison function must be\nspecified in init_queue().\n");
+    exit(1);
+  }
 
-  nolock_next_element(q);
+  if (to->duplicates && ! to->hash && from->queue && same_allocator(to, from) &&
+      ! to->track_changes && ! from->track_changes &&
+      (to->priority_is_tag_only ||
+       (! from->priority_is_tag_only &&
+	(to->tail == NULL || from->queue->priority <= to->tail->priority)))) {
+    // everything in 'from' belongs at the rear of 'to', in order
+    moved = splice_all(to, from);
+  }
 
-  // release lock on queue
-  pthread_mutex_unlock(&(q->lock));
+  while ((e = from->queue) != NULL) {
+    unlink_element(from, e);
+
+    if (to->queue && ! to->duplicates && nolock_element_in_queue(to, e->info)) {
+      // duplicates are silently deleted
+      free_element(from, e);
+      continue;
+    }
+
+    e = transfer_element(to, from, e);
+    if (! to->priority_is_tag_only && ! from->priority_is_tag_only) {
+      // a prioritized 'from' is already in queue order, so the
+      // insertion point only moves forward
+      prev = advance_insertion_point(to, prev, e->priority);
+    }
+    else {
+      prev = insertion_point(to, e->priority);
+    }
+    link_element(to, e, prev);
+    moved++;
+  }
+
+  nolock_rewind_queue(to);
+  nolock_rewind_queue(from);
+
+  return moved;
 }
 
 
-void nolock_next_element(Queue *q) {
+unsigned int empty_queue(Queue *q) {
 
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_next_element() **\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c empty_queue() **\n");
     exit(1);
   }
   
-#if defined(CONSISTENCY_CHECKING)
-  if (q->queue == NULL) {
-    fprintf(stderr, "NULL pointer in function next_element()\n");
-    exit(1);
-  }
-  else if (q->current == NULL) {
-    fprintf(stderr,
-	    "Advance past end--NULL pointer in function next_element()\n");
-    exit(1);
-  }
-  else
-#endif
-    {
-      q->previous = q->current;
-      q->current = q->current->next;
-    }
+  // no lock needed--see queue_length()
+  return atomic_load_explicit(&(q->queuelength), memory_order_acquire) == 0;
 }
- 
- 
 
-void rewind_queue(Queue *q) {
+
+int nolock_empty_queue(Queue *q) {
 
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c rewind_queue() **\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_empty_queue() **\n");
     exit(1);
   }
-
-  // lock entire queue
-  pthread_mutex_lock(&(q->lock));
-
-  nolock_rewind_queue(q);
   
-  // release lock on queue
-  pthread_mutex_unlock(&(q->lock));
+  return LENGTH(q) == 0;
+
 }
 
 
-void nolock_rewind_queue(Queue *q) {
+void *remove_from_front(Queue *q, void *element) {
+
+  void *ret = NULL;
 
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_rewind_queue() **\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c remove_from_front() **\n");
     exit(1);
   }
+  
+  // lock entire queue
+  PRIOQUE_LOCK(q);
 
-  q->current = q->queue;
-  q->previous = NULL;
+  ret = nolock_nosync_remove_from_front(q, element);
 
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+
+  return ret;
 }
 
 
-unsigned long queue_length(Queue *q) {
+void *remove_from_front_sync(Queue *q, void *element, 
+			     atomic_uint *j, int change) {
+
+  void *ret = NULL;
 
-  unsigned long ret;
-  
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c queue_length() **\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c remove_from_front_sync() **\n");
     exit(1);
   }
   
   // lock entire queue
-  pthread_mutex_lock(&(q->lock));
+  PRIOQUE_LOCK(q);
+  
+  ret = nolock_nosync_remove_from_front(q, element);
   
-  ret = nolock_queue_length(q);
+  if (ret) {
+    if (change >= 0) {
+      atomic_fetch_add(j, change);
+    }
+    else {
+      atomic_fetch_sub(j, change * -1);
+    }
+  }
   
   // release lock on queue
   pthread_mutex_unlock(&(q->lock));
@@ -751,228 +1306,307 @@ unsigned long queue_length(Queue *q) {
 }
 
 
-unsigned long nolock_queue_length(Queue *q) {
+void *remove_from_front_wait(Queue *q, void *element, long timeout_ms) {
+
+  struct timespec deadline;
+  unsigned long wakeups;
+  void *ret = NULL;
+  int timed_out = FALSE;
 
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_queue_length() **\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c remove_from_front_wait() **\n");
     exit(1);
   }
-  
-  return q->queuelength;
 
-}
+  if (timeout_ms > 0) {
+    deadline_after(&deadline, timeout_ms);
+  }
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  wakeups = q->wakeups;
+  while (q->queue == NULL && ! q->closed && ! timed_out &&
+	 timeout_ms != 0 && wakeups == q->wakeups) {
+    (q->waiters)++;
+    if (timeout_ms < 0) {
+      pthread_cond_wait(&(q->nonempty), &(q->lock));
+    }
+    else {
+      timed_out = (pthread_cond_timedwait(&(q->nonempty), &(q->lock), &deadline) != 0);
+    }
+    (q->waiters)--;
+  }
 
+  ret = nolock_nosync_remove_from_front(q, element);
 
-void copy_queue(Queue *q1, Queue *q2) {
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
 
-  if (q1->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** FIRST QUEUE NOT INITIALIZED in prioque.c copy_queue() **\n");
-    exit(1);
-  }
+  return ret;
+}
 
-  if (q2->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** SECOND QUEUE NOT INITIALIZED in prioque.c copy_queue() **\n");
+
+void wakeup_queue(Queue *q) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c wakeup_queue() **\n");
     exit(1);
   }
 
-  // to avoid deadlock, this function acquires a global package
-  // lock!
-  pthread_mutex_lock(&global_lock);
-
-  // lock entire queues q1, q2
-  pthread_mutex_lock(&(q1->lock));
-  pthread_mutex_lock(&(q2->lock));
+  // lock entire queue
+  PRIOQUE_LOCK(q);
 
-  // free elements in q1 before copy 
+  (q->wakeups)++;
+  pthread_cond_broadcast(&(q->nonempty));
+  pthread_cond_broadcast(&(q->notfull));
 
-  nolock_destroy_queue(q1);
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+}
 
-  // now make q1 a clone of q2 
 
-  q1->queuelength = 0;
-  q1->elementsize = q2->elementsize;
-  q1->queue = NULL;
-  q1->tail = NULL;
-  q1->duplicates = q2->duplicates;
-  q1->priority_is_tag_only = q2->priority_is_tag_only;
-  q1->compare = q2->compare;
+void close_queue(Queue *q) {
 
-  nolock_rewind_queue(q2);
-  while (! nolock_end_of_queue(q2)) {
-    nolock_add_to_queue(q1, nolock_pointer_to_current(q2), nolock_current_priority(q2));
-    nolock_next_element(q2);
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c close_queue() **\n");
+    exit(1);
   }
-     
 
-  nolock_rewind_queue(q1);
-  nolock_rewind_queue(q2);
-  
-  // release locks on q1, q2
-  pthread_mutex_unlock(&(q2->lock));
-  pthread_mutex_unlock(&(q1->lock));
+  // lock entire queue
+  PRIOQUE_LOCK(q);
 
-  // release global package lock
-  pthread_mutex_unlock(&global_lock);
-  
+  q->closed = TRUE;
+  pthread_cond_broadcast(&(q->nonempty));
+  pthread_cond_broadcast(&(q->notfull));
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
 }
 
 
-unsigned int equal_queues(Queue *q1, Queue *q2) {
+unsigned int queue_closed(Queue *q) {
 
-  Queue_element temp1, temp2;
-  unsigned int same = TRUE;
+  unsigned int ret;
 
-  if (q1->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** FIRST QUEUE NOT INITIALIZED in prioque.c equal_queues() **\n");
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c queue_closed() **\n");
     exit(1);
   }
 
-  if (q2->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** SECOND QUEUE NOT INITIALIZED in prioque.c equal_queues() **\n");
-    exit(1);
-  }
+  // lock entire queue
+  PRIOQUE_LOCK(q);
 
-  // to avoid deadlock, this function acquires a global package
-  // lock!
-  pthread_mutex_lock(&global_lock);
+  ret = q->closed;
 
-  // lock entire queues q1, q2
-  pthread_mutex_lock(&(q1->lock));
-  pthread_mutex_lock(&(q2->lock));
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
 
-  if (q1->queuelength != q2->queuelength || q1->elementsize != q2->elementsize) {
-    same = FALSE;
-  }
-  else {
-    temp1 = q1->queue;
-    temp2 = q2->queue;
-    while (same && temp1 != NULL) {
-      same = (!memcmp(temp1->info, temp2->info, q1->elementsize) &&
-	      temp1->priority == temp2->priority);
-      temp1 = temp1->next;
-      temp2 = temp2->next;
-    }
+  return ret;
+}
+
+
+void set_queue_capacity(Queue *q, unsigned long capacity) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c set_queue_capacity() **\n");
+    exit(1);
   }
 
-  // release locks on q1, q2
-  pthread_mutex_unlock(&(q2->lock));
-  pthread_mutex_unlock(&(q1->lock));
+  // lock entire queue
+  PRIOQUE_LOCK(q);
 
-  // release global package lock
-  pthread_mutex_unlock(&global_lock);
+  q->capacity = capacity;
+  // a larger capacity may make room for waiting producers
+  pthread_cond_broadcast(&(q->notfull));
 
-  return same;
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
 }
 
 
-void merge_queues(Queue *q1, Queue *q2) {
+int try_add_to_queue(Queue *q, void *element, int priority) {
 
-  Queue_element temp;
-  
-  if (q1->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** FIRST QUEUE NOT INITIALIZED in prioque.c merge_queues() **\n");
-    exit(1);
-  }
-  
-  if (q2->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** SECOND QUEUE NOT INITIALIZED in prioque.c merge_queues() **\n");
+  int ret;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c try_add_to_queue() **\n");
     exit(1);
   }
-  
-  // to avoid deadlock, this function acquires a global package
-  // lock!
-  pthread_mutex_lock(&global_lock);
 
-  // lock entire queues q1, q2
-  pthread_mutex_lock(&(q1->lock));
-  pthread_mutex_lock(&(q2->lock));
+  // lock entire queue
+  PRIOQUE_LOCK(q);
 
-  temp = q2->queue;
+  ret = nolock_try_add_to_queue(q, element, priority);
 
-  while (temp != NULL) {
-    nolock_add_to_queue(q1, temp->info, temp->priority);
-    temp = temp->next;
-  }
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
 
-  nolock_rewind_queue(q1);
+  return ret;
+}
 
-  // release locks on q1, q2
-  pthread_mutex_unlock(&(q2->lock));
-  pthread_mutex_unlock(&(q1->lock));
 
-  // release global package lock
-  pthread_mutex_unlock(&global_lock);
+int nolock_try_add_to_queue(Queue *q, void *element, int priority) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_try_add_to_queue() **\n");
+    exit(1);
+  }
+
+  if (q->capacity && LENGTH(q) >= q->capacity) {
+    return FALSE;
+  }
+
+  nolock_add_to_queue_handle(q, element, priority);
 
+  return TRUE;
 }
 
 
-unsigned int serialize_queue(Queue *q,
-			     int (*serialize_element)(void *element,
-						      int *priority,
-						      FILE *fp,
-						      StateSerialization mode),
-			     FILE *fp) {
+int add_to_queue_wait(Queue *q, void *element, int priority, long timeout_ms) {
 
-  unsigned long num_elements;
-  unsigned int ret = TRUE;
-  int p;
+  struct timespec deadline;
+  unsigned long wakeups;
+  int ret = FALSE, timed_out = FALSE;
 
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c serialize_queue() **\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c add_to_queue_wait() **\n");
     exit(1);
   }
-  
-  // lock entire queue
-  pthread_mutex_lock(&(q->lock));
 
-  // write # of elements in queue
-  num_elements = nolock_queue_length(q);
-  ret = (fwrite(&num_elements, sizeof(unsigned long), 1, fp) == 1);
+  if (timeout_ms > 0) {
+    deadline_after(&deadline, timeout_ms);
+  }
 
-  if (ret) {
-    nolock_rewind_queue(q);
-    while (ret && ! nolock_end_of_queue(q)) {
-      p = nolock_current_priority(q);
-      ret = serialize_element(nolock_pointer_to_current(q),
-			      &p, fp, SERIALIZE);
-      nolock_next_element(q);
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  wakeups = q->wakeups;
+  while (q->capacity && LENGTH(q) >= q->capacity && ! q->closed && ! timed_out &&
+	 timeout_ms != 0 && wakeups == q->wakeups) {
+    (q->full_waiters)++;
+    if (timeout_ms < 0) {
+      pthread_cond_wait(&(q->notfull), &(q->lock));
+    }
+    else {
+      timed_out = (pthread_cond_timedwait(&(q->notfull), &(q->lock), &deadline) != 0);
     }
+    (q->full_waiters)--;
+  }
+
+  if (! q->closed) {
+    ret = nolock_try_add_to_queue(q, element, priority);
   }
 
   // release lock on queue
   pthread_mutex_unlock(&(q->lock));
-  
+
   return ret;
 }
 
 
-unsigned int deserialize_queue(Queue *q,
-			       int (*deserialize_element)(void *element,
-							  int *priority,
-							  FILE *fp,
-							  StateSerialization mode),
-			       FILE *fp) {
-  
-  void *element = NULL;
-  int priority;
-  unsigned long num_elements;
-  unsigned int ret = TRUE;
+void set_queue_watermarks(Queue *q, unsigned long high, unsigned long low,
+			  void (*callback) (Queue *q, unsigned int high, void *ctx),
+			  void *ctx) {
 
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c deserialize_queue() **\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c set_queue_watermarks() **\n");
     exit(1);
   }
-  
+
+  if (callback && low >= high) {
+    fprintf(stderr, "prioque.c: set_queue_watermarks() requires low < high.\n");
+    exit(1);
+  }
+
   // lock entire queue
-  pthread_mutex_lock(&(q->lock));
+  PRIOQUE_LOCK(q);
+
+  q->high_watermark = high;
+  q->low_watermark = low;
+  q->watermark = callback;
+  q->watermark_ctx = ctx;
+  q->above_watermark = FALSE;
+  if (callback) {
+    check_watermarks(q);
+  }
 
-  // read # of elements in queue
-  ret = (fread(&num_elements, sizeof(unsigned long), 1, fp) == 1);
-  
-  while (ret && num_elements-- > 0 &&
-	 (ret = deserialize_element(&element, &priority, fp, DESERIALIZE) > 0)) {
-    nolock_add_to_queue(q, &element, priority);
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+}
+
+
+// run 'fn' on element 'e' of 'q' and apply the action it returns.
+// An element to be repositioned is unlinked and, if 'pending' is not
+// NULL, appended to the list 'pending' / 'pending_tail' (chained
+// through 'next') to be relinked by the caller; otherwise it is
+// relinked at once.
+static Queue_action apply_update(Queue *q, Queue_element e, Queue_updater fn, void *ctx,
+				 Queue_element *pending, Queue_element *pending_tail) {
+
+  Queue_action action;
+  int priority = e->priority;
+  unsigned int held;
+
+  // the callback may change the element's hash key
+  if (q->hash) {
+    index_remove(q, e);
+  }
+  action = fn(e->info, &priority, ctx);
+  if (q->hash) {
+    e->hash = q->hash(e->info);
+    index_insert(q, e);
+  }
+
+  if (action == QUEUE_REMOVE) {
+    unlink_element(q, e);
+    free_element(q, e);
   }
+  else if (action == QUEUE_REQUEUE ||
+	   (priority != e->priority && ! q->priority_is_tag_only)) {
+    // the element is only repositioned
+    held = q->hold_watermarks;
+    q->hold_watermarks = TRUE;
+    unlink_element(q, e);
+    e->priority = priority;
+    if (pending) {
+      if (*pending == NULL) {
+	*pending = e;
+      }
+      else {
+	(*pending_tail)->next = e;
+      }
+      *pending_tail = e;
+    }
+    else {
+      link_element(q, e, insertion_point(q, priority));
+    }
+    q->hold_watermarks = held;
+  }
+  else {
+    e->priority = priority;
+    if (q->track_changes) {
+      e->epoch = q->epoch;
+    }
+  }
+
+  return action;
+}
+
+
+int update_front(Queue *q, Queue_updater fn, void *ctx) {
+
+  int ret;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c update_front() **\n");
+    exit(1);
+  }
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  ret = nolock_update_front(q, fn, ctx);
 
   // release lock on queue
   pthread_mutex_unlock(&(q->lock));
@@ -981,30 +1615,2576 @@ unsigned int deserialize_queue(Queue *q,
 }
 
 
-// lock the queue globally, to allow use of nolock_* functions
-void lock_queue(Queue *q) {
+int nolock_update_front(Queue *q, Queue_updater fn, void *ctx) {
+
+  int ret = -1;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_update_front() **\n");
+    exit(1);
+  }
+
+  if (q->queue) {
+    ret = apply_update(q, q->queue, fn, ctx, NULL, NULL);
+  }
+
+  nolock_rewind_queue(q);
+
+  return ret;
+}
+
+
+int update_handle(Queue *q, Queue_element h, Queue_updater fn, void *ctx) {
+
+  int ret;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c update_handle() **\n");
+    exit(1);
+  }
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  ret = nolock_update_handle(q, h, fn, ctx);
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+
+  return ret;
+}
+
+
+int nolock_update_handle(Queue *q, Queue_element h, Queue_updater fn, void *ctx) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_update_handle() **\n");
+    exit(1);
+  }
+
+#if defined(CONSISTENCY_CHECKING)
+  if (h == NULL) {
+    fprintf(stderr, "NULL handle in function update_handle()\n");
+    exit(1);
+  }
+#endif
+
+  return apply_update(q, h, fn, ctx, NULL, NULL);
+}
+
+
+unsigned long update_matching(Queue *q, void *element, Queue_updater fn, void *ctx) {
+
+  unsigned long ret;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c update_matching() **\n");
+    exit(1);
+  }
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  ret = nolock_update_matching(q, element, fn, ctx);
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+
+  return ret;
+}
+
+
+unsigned long nolock_update_matching(Queue *q, void *element, Queue_updater fn, void *ctx) {
+
+  Queue_element e, next, pending = NULL, pending_tail = NULL;
+  unsigned long visited = 0;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_update_matching() **\n");
+    exit(1);
+  }
+
+  if (element && ! q->compare) {
+    fprintf(stderr, "prioque.c: update_matching() requires the comparison function to be\nspecified in init_queue().\n");
+    exit(1);
+  }
+
+  // requeued elements are out of the queue until the end, so
+  // watermarks are checked once, on the final length
+  q->hold_watermarks = TRUE;
+  for (e = q->queue; e != NULL; e = next) {
+    next = e->next;
+    PRIOQUE_STAT(q, scan_steps);
+    if (element && (PRIOQUE_STAT(q, compares), q->compare(element, e->info) != 0)) {
+      continue;
+    }
+    apply_update(q, e, fn, ctx, &pending, &pending_tail);
+    visited++;
+  }
+
+  // relink requeued elements only now, so they aren't visited twice
+  while (pending != NULL) {
+    e = pending;
+    pending = e->next;
+    link_element(q, e, insertion_point(q, e->priority));
+  }
+  q->hold_watermarks = FALSE;
+  if (q->watermark) {
+    check_watermarks(q);
+  }
+
+  nolock_rewind_queue(q);
+
+  return visited;
+}
+
+
+void *nolock_nosync_remove_from_front(Queue *q, void *element) {
+
+  Queue_element temp;
+  void *ret = NULL;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_nosync_remove_from_front() **\n");
+    exit(1);
+  }
+  
+  if (q->queue) {
+    memcpy(element, q->queue->info, q->elementsize);
+    ret = element;
+    temp = q->queue;
+    unlink_element(q, temp);
+    free_element(q, temp);
+  }
+
+  nolock_rewind_queue(q);
+
+  //  if (ret) {
+  //    printf("REMOVED %p from queue %p\n", *((unsigned long *)ret), q);
+  //    
+  //    printf("Queue %p now contains:\n", q);
+  //    Queue_element ptr=q->queue;
+  //    while (ptr) {
+  //      printf("-->%p\n", *((unsigned long *)ptr->info));
+  //      ptr = ptr->next;
+  //    }
+  //    printf("---------------\n");
+  //  }
   
+  return ret;
+}
+
+
+void *peek_at_current(Queue *q, void *element, int *priority) {
+
+  void *ret = NULL;
+
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c lock_queue() **\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c peek_at_current() **\n");
+    exit(1);
+  }
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  ret = nolock_peek_at_current(q, element, priority);
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+
+  return ret;
+}
+
+
+void *nolock_peek_at_current(Queue *q, void *element, int *priority) {
+
+  void *ret = NULL;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_peek_at_current() **\n");
     exit(1);
   }
   
+  if (q->queue && q->current) {
+    memcpy(element, (q->current)->info, q->elementsize);
+    ret = element;
+    if (priority) {
+      *priority = (q->current)->priority;
+    }
+  }
+  
+  return ret;
+}
+
+
+void *pointer_to_current(Queue *q) {
+
+  void *data = NULL;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c pointer_to_current() **\n");
+    exit(1);
+  }
+
   // lock entire queue
-  pthread_mutex_lock(&(q->lock));
+  PRIOQUE_LOCK(q);
+
+  data = nolock_pointer_to_current(q);
+  
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+  
+  return data;
+}
+
+
+void *nolock_pointer_to_current(Queue *q) {
+
+  void *data = NULL;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_pointer_to_current() **\n");
+    exit(1);
+  }
+  
+  if (q->queue && q->current) {
+    data = (q->current)->info;
+  }
   
+  return data;
 }
 
-// unlock the queue
-void unlock_queue(Queue *q) {
+
+int current_priority(Queue *q) {
+  
+  int priority;
 
   if (q->magic != QUEUE_MAGIC) {
-    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c unlock_queue() **\n");
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c current_priority() **\n");
     exit(1);
   }
   
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+  
+  priority = nolock_current_priority(q);
+  
   // release lock on queue
   pthread_mutex_unlock(&(q->lock));
   
+  return priority;
 }
 
 
+int nolock_current_priority(Queue *q) {
+
+  int priority;
+  
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_current_priority() **\n");
+    exit(1);
+  }
+  
+#if defined(CONSISTENCY_CHECKING)
+  if (q->queue == NULL || q->current == NULL) {
+    fprintf(stderr, "NULL pointer in function current_priority()\n");
+    exit(1);
+  }
+  else
+#endif
+  {
+
+    priority = (q->current)->priority;
+    
+    return priority;
+  }
+}
+
+
+Queue_element current_handle(Queue *q) {
+
+  Queue_element h;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c current_handle() **\n");
+    exit(1);
+  }
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  h = nolock_current_handle(q);
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+
+  return h;
+}
+
+
+Queue_element nolock_current_handle(Queue *q) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_current_handle() **\n");
+    exit(1);
+  }
+
+  return q->queue ? q->current : NULL;
+}
+
+ 
+ void nolock_update_current(Queue *q, void *element) {
+   
+   if (q->magic != QUEUE_MAGIC) {
+     fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_update_current() **\n");
+     exit(1);
+   }
+   
+#if defined(CONSISTENCY_CHECKING)
+   if (q->queue == NULL || q->current == NULL) {
+    fprintf(stderr, "NULL pointer in function update_current()\n");
+    exit(1);
+   }
+   else
+#endif
+     {
+       // the new contents may have a different hash key
+       if (q->hash) {
+	 index_remove(q, q->current);
+       }
+       memcpy(q->current->info, element, q->elementsize);
+       if (q->hash) {
+	 q->current->hash = q->hash(q->current->info);
+	 index_insert(q, q->current);
+       }
+       if (q->track_changes) {
+	 q->current->epoch = q->epoch;
+       }
+     }
+ }
+ 
+ 
+void update_current(Queue *q, void *element) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c update_current() **\n");
+    exit(1);
+  }
+  
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  nolock_update_current(q, element);
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+}
+
+
+void delete_current(Queue *q) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c delete_current() **\n");
+    exit(1);
+  }
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  nolock_delete_current(q);
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+
+}
+
+
+void nolock_delete_current(Queue *q) {
+
+  Queue_element temp;
+  
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_delete_current() **\n");
+    exit(1);
+  }
+
+  #if defined(CONSISTENCY_CHECKING)
+  if (q->queue == NULL || q->current == NULL) {
+    fprintf(stderr, "NULL pointer in prioque function delete_current()\n");
+    exit(1);
+  }
+  else
+#endif
+  {
+
+    temp = q->current;
+    unlink_element(q, temp);
+    free_element(q, temp);
+
+  }
+}
+
+
+unsigned int end_of_queue(Queue *q) {
+
+  unsigned int ret;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c end_of_queue() **\n");
+    exit(1);
+  }
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  ret = nolock_end_of_queue(q);
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+
+  return ret;
+}
+
+unsigned int nolock_end_of_queue(Queue *q) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c delete_current() **\n");
+    exit(1);
+  }
+  
+  return (q->current == NULL);
+}
+
+
+void next_element(Queue *q) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c next_element() **\n");
+    exit(1);
+  }
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  nolock_next_element(q);
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+}
+
+
+void nolock_next_element(Queue *q) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_next_element() **\n");
+    exit(1);
+  }
+  
+#if defined(CONSISTENCY_CHECKING)
+  if (q->queue == NULL) {
+    fprintf(stderr, "NULL pointer in function next_element()\n");
+    exit(1);
+  }
+  else if (q->current == NULL) {
+    fprintf(stderr,
+	    "Advance past end--NULL pointer in function next_element()\n");
+    exit(1);
+  }
+  else
+#endif
+    {
+      q->previous = q->current;
+      q->current = q->current->next;
+    }
+}
+ 
+ 
+
+void rewind_queue(Queue *q) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c rewind_queue() **\n");
+    exit(1);
+  }
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  nolock_rewind_queue(q);
+  
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+}
+
+
+void nolock_rewind_queue(Queue *q) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_rewind_queue() **\n");
+    exit(1);
+  }
+
+  q->current = q->queue;
+  q->previous = NULL;
+
+}
+
+
+unsigned long queue_length(Queue *q) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c queue_length() **\n");
+    exit(1);
+  }
+  
+  // no lock needed: the acquire load pairs with the release store
+  // made by whichever update last changed the length
+  return atomic_load_explicit(&(q->queuelength), memory_order_acquire);
+}
+
+
+unsigned long nolock_queue_length(Queue *q) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_queue_length() **\n");
+    exit(1);
+  }
+  
+  return LENGTH(q);
+
+}
+
+
+void copy_queue(Queue *q1, Queue *q2) {
+
+  if (q1->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** FIRST QUEUE NOT INITIALIZED in prioque.c copy_queue() **\n");
+    exit(1);
+  }
+
+  if (q2->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** SECOND QUEUE NOT INITIALIZED in prioque.c copy_queue() **\n");
+    exit(1);
+  }
+
+  // lock entire queues q1, q2.  Locks are always taken in address
+  // order, so concurrent multi-queue operations can't deadlock.
+  lock_two_queues(q1, q2);
+
+  if (q1 == q2) {
+    // a queue is already a copy of itself
+    unlock_two_queues(q1, q2);
+    return;
+  }
+
+  // free elements in q1 before copy 
+
+  nolock_destroy_queue(q1);
+
+  // now make q1 a clone of q2 
+
+  SET_LENGTH(q1, 0);
+  q1->elementsize = q2->elementsize;
+  q1->queue = NULL;
+  q1->tail = NULL;
+  q1->duplicates = q2->duplicates;
+  q1->priority_is_tag_only = q2->priority_is_tag_only;
+  q1->compare = q2->compare;
+  q1->hash = q2->hash;
+
+  clone_into(q1, q2);
+
+
+  nolock_rewind_queue(q1);
+  nolock_rewind_queue(q2);
+  
+  // release locks on q1, q2
+  unlock_two_queues(q1, q2);
+  
+}
+
+
+unsigned int equal_queues(Queue *q1, Queue *q2) {
+
+  Queue_element temp1, temp2;
+  unsigned int same = TRUE;
+
+  if (q1->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** FIRST QUEUE NOT INITIALIZED in prioque.c equal_queues() **\n");
+    exit(1);
+  }
+
+  if (q2->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** SECOND QUEUE NOT INITIALIZED in prioque.c equal_queues() **\n");
+    exit(1);
+  }
+
+  // lock entire queues q1, q2.  Locks are always taken in address
+  // order, so concurrent multi-queue operations can't deadlock.
+  lock_two_queues(q1, q2);
+
+  if (LENGTH(q1) != LENGTH(q2) || q1->elementsize != q2->elementsize) {
+    same = FALSE;
+  }
+  else {
+    temp1 = q1->queue;
+    temp2 = q2->queue;
+    while (same && temp1 != NULL) {
+      same = (!memcmp(temp1->info, temp2->info, q1->elementsize) &&
+	      temp1->priority == temp2->priority);
+      temp1 = temp1->next;
+      temp2 = temp2->next;
+    }
+  }
+
+  // release locks on q1, q2
+  unlock_two_queues(q1, q2);
+
+  return same;
+}
+
+
+void merge_queues(Queue *q1, Queue *q2) {
+
+  if (q1->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** FIRST QUEUE NOT INITIALIZED in prioque.c merge_queues() **\n");
+    exit(1);
+  }
+  
+  if (q2->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** SECOND QUEUE NOT INITIALIZED in prioque.c merge_queues() **\n");
+    exit(1);
+  }
+  
+  // lock entire queues q1, q2.  Locks are always taken in address
+  // order, so concurrent multi-queue operations can't deadlock.
+  lock_two_queues(q1, q2);
+
+  if (q1 != q2) {
+    clone_into(q1, q2);
+  }
+
+  nolock_rewind_queue(q1);
+
+  // release locks on q1, q2
+  unlock_two_queues(q1, q2);
+
+}
+
+
+unsigned int serialize_queue(Queue *q,
+			     int (*serialize_element)(void *element,
+						      int *priority,
+						      FILE *fp,
+						      StateSerialization mode),
+			     FILE *fp) {
+
+  unsigned long num_elements;
+  unsigned int ret = TRUE;
+  int p;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c serialize_queue() **\n");
+    exit(1);
+  }
+  
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  // write # of elements in queue
+  num_elements = nolock_queue_length(q);
+  ret = (fwrite(&num_elements, sizeof(unsigned long), 1, fp) == 1);
+
+  if (ret) {
+    nolock_rewind_queue(q);
+    while (ret && ! nolock_end_of_queue(q)) {
+      p = nolock_current_priority(q);
+      ret = serialize_element(nolock_pointer_to_current(q),
+			      &p, fp, SERIALIZE);
+      nolock_next_element(q);
+    }
+  }
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+  
+  return ret;
+}
+
+
+unsigned int deserialize_queue(Queue *q,
+			       int (*deserialize_element)(void *element,
+							  int *priority,
+							  FILE *fp,
+							  StateSerialization mode),
+			       FILE *fp) {
+  
+  void *element = NULL;
+  int priority;
+  unsigned long num_elements;
+  unsigned int ret = TRUE;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c deserialize_queue() **\n");
+    exit(1);
+  }
+  
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  // read # of elements in queue
+  ret = (fread(&num_elements, sizeof(unsigned long), 1, fp) == 1);
+  
+  while (ret && num_elements-- > 0 &&
+	 (ret = deserialize_element(&element, &priority, fp, DESERIALIZE) > 0)) {
+    nolock_add_to_queue(q, &element, priority);
+  }
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+
+  return ret;
+}
+
+
+// store 'v' at 'p' as 'n' little-endian bytes
+static void put_le(unsigned char *p, uint64_t v, int n) {
+
+  int i;
+
+  for (i = 0; i < n; i++) {
+    p[i] = (unsigned char) (v >> (8 * i));
+  }
+}
+
+
+// return the 'n' byte little-endian value at 'p'
+static uint64_t get_le(const unsigned char *p, int n) {
+
+  uint64_t v = 0;
+  int i;
+
+  for (i = n - 1; i >= 0; i--) {
+    v = (v << 8) | p[i];
+  }
+
+  return v;
+}
+
+
+// byte order of element data on this host, as stored in queue files
+static uint32_t host_byte_order(void) {
+
+  const uint16_t one = 1;
+
+  return *(const unsigned char *) &one == 1 ? 1 : 2;
+}
+
+
+// continue a 64-bit FNV-1a checksum 'h' over 'n' bytes at 'p'
+static uint64_t checksum_bytes(uint64_t h, const unsigned char *p, size_t n) {
+
+  while (n-- > 0) {
+    h ^= *p++;
+    h *= 0x100000001b3ULL;
+  }
+
+  return h;
+}
+
+#define CHECKSUM_INIT 0xcbf29ce484222325ULL
+
+
+// encode the record for element 'e' of 'q' at 'rec'
+static void encode_record(Queue *q, Queue_element e, unsigned char *rec) {
+
+  size_t recsize = QUEUE_FILE_RECORD_SIZE(q->elementsize);
+
+  put_le(rec, (uint32_t) e->priority, 4);
+  memset(rec + 4, 0, 4);
+  memcpy(rec + QUEUE_FILE_RECORD_HEADER, e->info, q->elementsize);
+  memset(rec + QUEUE_FILE_RECORD_HEADER + q->elementsize, 0,
+	 recsize - QUEUE_FILE_RECORD_HEADER - q->elementsize);
+}
+
+
+unsigned int save_queue(Queue *q, FILE *fp) {
+
+  unsigned char header[QUEUE_FILE_HEADER_SIZE], *buf;
+  size_t recsize, per_block, used;
+  uint64_t checksum = CHECKSUM_INIT;
+  Queue_element e;
+  unsigned int ret = TRUE;
+  int pass;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c save_queue() **\n");
+    exit(1);
+  }
+
+  recsize = QUEUE_FILE_RECORD_SIZE(q->elementsize);
+  per_block = QUEUE_FILE_BUFFER_SIZE / recsize;
+  if (per_block == 0) {
+    per_block = 1;
+  }
+  buf = (unsigned char *) malloc(per_block * recsize);
+  if (buf == NULL) {
+    fprintf(stderr, "malloc() failed in function save_queue()\n");
+    exit(1);
+  }
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  // the checksum goes in the header, so records are encoded twice:
+  // once to checksum them, then again to write them
+  for (pass = 0; ret && pass < 2; pass++) {
+    if (pass == 1) {
+      memset(header, 0, sizeof(header));
+      memcpy(header, "PRIOQUE", 8);
+      put_le(header + 8, QUEUE_FILE_VERSION, 4);
+      put_le(header + 12, host_byte_order(), 4);
+      put_le(header + 16, q->elementsize, 4);
+      put_le(header + 20, (q->duplicates ? QUEUE_FILE_DUPLICATES : 0) |
+	     (q->priority_is_tag_only ? QUEUE_FILE_TAG_ONLY : 0), 4);
+      put_le(header + 24, LENGTH(q), 8);
+      put_le(header + 32, checksum, 8);
+      put_le(header + 40, recsize, 4);
+      ret = (fwrite(header, sizeof(header), 1, fp) == 1);
+    }
+    used = 0;
+    for (e = q->queue; ret && e != NULL; e = e->next) {
+      encode_record(q, e, buf + used);
+      used += recsize;
+      if (used == per_block * recsize || e->next == NULL) {
+	if (pass == 0) {
+	  checksum = checksum_bytes(checksum, buf, used);
+	}
+	else {
+	  ret = (fwrite(buf, used, 1, fp) == 1);
+	}
+	used = 0;
+      }
+    }
+  }
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+
+  free(buf);
+
+  return ret && fflush(fp) == 0;
+}
+
+
+// validate a queue file 'header' for 'q'.  Returns TRUE and sets
+// '*count' and '*checksum' if it is acceptable, otherwise prints why
+// not and returns FALSE.
+static unsigned int check_queue_file_header(Queue *q, const unsigned char *header,
+					    uint64_t *count, uint64_t *checksum) {
+
+  if (memcmp(header, "PRIOQUE", 8) != 0) {
+    fprintf(stderr, "prioque.c: not a queue file.\n");
+    return FALSE;
+  }
+  if (get_le(header + 8, 4) != QUEUE_FILE_VERSION) {
+    fprintf(stderr, "prioque.c: unsupported queue file version %lu.\n",
+	    (unsigned long) get_le(header + 8, 4));
+    return FALSE;
+  }
+  if (get_le(header + 12, 4) != host_byte_order()) {
+    fprintf(stderr, "prioque.c: queue file was written on a host with a different byte order.\n");
+    return FALSE;
+  }
+  if (get_le(header + 16, 4) != q->elementsize ||
+      get_le(header + 40, 4) != QUEUE_FILE_RECORD_SIZE(q->elementsize)) {
+    fprintf(stderr, "prioque.c: queue file element size %lu doesn't match queue.\n",
+	    (unsigned long) get_le(header + 16, 4));
+    return FALSE;
+  }
+
+  *count = get_le(header + 24, 8);
+  *checksum = get_le(header + 32, 8);
+
+  return TRUE;
+}
+
+
+// append the 'n' records at 'recs' to 'q'
+static void add_records(Queue *q, const unsigned char *recs, size_t n) {
+
+  size_t recsize = QUEUE_FILE_RECORD_SIZE(q->elementsize);
+
+  while (n-- > 0) {
+    nolock_add_to_queue(q, (void *) (recs + QUEUE_FILE_RECORD_HEADER),
+			(int) (uint32_t) get_le(recs, 4));
+    recs += recsize;
+  }
+}
+
+
+unsigned int load_queue(Queue *q, FILE *fp) {
+
+  unsigned char header[QUEUE_FILE_HEADER_SIZE], *buf;
+  uint64_t count, checksum, sum = CHECKSUM_INIT;
+  size_t recsize, per_block, size, got, n;
+  unsigned int ret;
+  long start;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c load_queue() **\n");
+    exit(1);
+  }
+
+  if (fread(header, sizeof(header), 1, fp) != 1 ||
+      ! check_queue_file_header(q, header, &count, &checksum)) {
+    return FALSE;
+  }
+
+  recsize = QUEUE_FILE_RECORD_SIZE(q->elementsize);
+  if (count > SIZE_MAX / recsize) {
+    fprintf(stderr, "prioque.c: queue file is too large.\n");
+    return FALSE;
+  }
+  per_block = QUEUE_FILE_BUFFER_SIZE / recsize;
+  if (per_block == 0) {
+    per_block = 1;
+  }
+
+  // the checksum must be verified before anything is added.  Seekable
+  // files are read twice in blocks; others are read whole.
+  start = ftell(fp);
+  if (start >= 0 && count * recsize > QUEUE_FILE_BUFFER_SIZE) {
+    uint64_t left;
+    int pass;
+
+    buf = (unsigned char *) malloc(per_block * recsize);
+    if (buf == NULL) {
+      fprintf(stderr, "prioque.c: out of memory loading queue file.\n");
+      return FALSE;
+    }
+
+    ret = TRUE;
+    for (pass = 0; ret && pass < 2; pass++) {
+      if (pass == 1) {
+	if (sum != checksum) {
+	  fprintf(stderr, "prioque.c: queue file checksum mismatch.\n");
+	  ret = FALSE;
+	  break;
+	}
+	ret = (fseek(fp, start, SEEK_SET) == 0);
+	// lock entire queue
+	PRIOQUE_LOCK(q);
+      }
+      for (left = count; ret && left > 0; left -= n) {
+	n = left < per_block ? left : per_block;
+	ret = (fread(buf, recsize, n, fp) == n);
+	if (! ret) {
+	  break;
+	}
+	if (pass == 0) {
+	  sum = checksum_bytes(sum, buf, n * recsize);
+	}
+	else {
+	  add_records(q, buf, n);
+	}
+      }
+      if (pass == 1) {
+	// release lock on queue
+	pthread_mutex_unlock(&(q->lock));
+      }
+    }
+    free(buf);
+    return ret;
+  }
+
+  // 'count' isn't trusted yet, so the buffer grows with the records
+  // actually read rather than being sized from it up front
+  buf = NULL;
+  size = 0;
+  ret = TRUE;
+  for (got = 0; ret && got < count; got += n) {
+    n = count - got < per_block ? count - got : per_block;
+    if ((got + n) * recsize > size) {
+      unsigned char *grown;
+
+      size = size > count * recsize / 2 ? count * recsize : size * 2;
+      if (size < (got + n) * recsize) {
+	size = (got + n) * recsize;
+      }
+      grown = (unsigned char *) realloc(buf, size);
+      if (grown == NULL) {
+	fprintf(stderr, "prioque.c: out of memory loading queue file.\n");
+	ret = FALSE;
+	break;
+      }
+      buf = grown;
+    }
+    ret = (fread(buf + got * recsize, recsize, n, fp) == n);
+  }
+  if (ret && checksum_bytes(sum, buf, count * recsize) != checksum) {
+    fprintf(stderr, "prioque.c: queue file checksum mismatch.\n");
+    ret = FALSE;
+  }
+  if (ret) {
+    // lock entire queue
+    PRIOQUE_LOCK(q);
+
+    add_records(q, buf, count);
+
+    // release lock on queue
+    pthread_mutex_unlock(&(q->lock));
+  }
+  free(buf);
+
+  return ret;
+}
+
+
+unsigned int load_queue_mmap(Queue *q, const char *filename) {
+
+  const unsigned char *map;
+  uint64_t count, checksum;
+  struct stat st;
+  size_t recsize;
+  unsigned int ret = FALSE;
+  int fd;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c load_queue_mmap() **\n");
+    exit(1);
+  }
+
+  if ((fd = open(filename, O_RDONLY)) < 0) {
+    return FALSE;
+  }
+  if (fstat(fd, &st) != 0 || st.st_size < QUEUE_FILE_HEADER_SIZE) {
+    close(fd);
+    return FALSE;
+  }
+  map = (const unsigned char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return FALSE;
+  }
+#if defined(MADV_SEQUENTIAL)
+  madvise((void *) map, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+  recsize = QUEUE_FILE_RECORD_SIZE(q->elementsize);
+  if (check_queue_file_header(q, map, &count, &checksum)) {
+    if (count > (st.st_size - QUEUE_FILE_HEADER_SIZE) / recsize) {
+      fprintf(stderr, "prioque.c: queue file is truncated.\n");
+    }
+    else if (checksum_bytes(CHECKSUM_INIT, map + QUEUE_FILE_HEADER_SIZE, count * recsize) != checksum) {
+      fprintf(stderr, "prioque.c: queue file checksum mismatch.\n");
+    }
+    else {
+      // lock entire queue
+      PRIOQUE_LOCK(q);
+
+      add_records(q, map + QUEUE_FILE_HEADER_SIZE, count);
+
+      // release lock on queue
+      pthread_mutex_unlock(&(q->lock));
+
+      ret = TRUE;
+    }
+  }
+
+  munmap((void *) map, st.st_size);
+
+  return ret;
+}
+
+
+// lock 'q1' and 'q2' in address order, or just once if they are the
+// same queue
+static void lock_two_queues(Queue *q1, Queue *q2) {
+
+  if (q1 == q2) {
+    PRIOQUE_LOCK(q1);
+  }
+  else if ((uintptr_t) q1 < (uintptr_t) q2) {
+    PRIOQUE_LOCK(q1);
+    PRIOQUE_LOCK(q2);
+  }
+  else {
+    PRIOQUE_LOCK(q2);
+    PRIOQUE_LOCK(q1);
+  }
+}
+
+
+// release locks taken by lock_two_queues()
+static void unlock_two_queues(Queue *q1, Queue *q2) {
+
+  pthread_mutex_unlock(&(q1->lock));
+  if (q1 != q2) {
+    pthread_mutex_unlock(&(q2->lock));
+  }
+}
+
+
+// sort 'queues' by address and drop repeated entries, returning the
+// number of distinct queues
+static unsigned int order_queues(Queue **queues, unsigned int n) {
+
+  unsigned int i, j, distinct = 0;
+  Queue *temp;
+
+  for (i = 1; i < n; i++) {
+    temp = queues[i];
+    for (j = i; j > 0 && (uintptr_t) queues[j - 1] > (uintptr_t) temp; j--) {
+      queues[j] = queues[j - 1];
+    }
+    queues[j] = temp;
+  }
+
+  for (i = 0; i < n; i++) {
+    if (distinct == 0 || queues[i] != queues[distinct - 1]) {
+      queues[distinct++] = queues[i];
+    }
+  }
+
+  return distinct;
+}
+
+
+// lock or unlock every queue in 'queues'
+static void lock_queue_set(Queue *queues[], unsigned int n, int lock) {
+
+  Queue *stack[LOCK_QUEUES_ON_STACK], **sorted = stack;
+  unsigned int i;
+
+  for (i = 0; i < n; i++) {
+    if (queues[i]->magic != QUEUE_MAGIC) {
+      fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c %s() **\n",
+	      lock ? "lock_queues" : "unlock_queues");
+      exit(1);
+    }
+  }
+
+  if (n > LOCK_QUEUES_ON_STACK) {
+    sorted = (Queue **) malloc(n * sizeof(Queue *));
+    if (sorted == NULL) {
+      fprintf(stderr, "malloc() failed in function lock_queues()\n");
+      exit(1);
+    }
+  }
+
+  memcpy(sorted, queues, n * sizeof(Queue *));
+  n = order_queues(sorted, n);
+
+  if (lock) {
+    for (i = 0; i < n; i++) {
+      PRIOQUE_LOCK(sorted[i]);
+    }
+  }
+  else {
+    for (i = n; i > 0; i--) {
+      pthread_mutex_unlock(&(sorted[i - 1]->lock));
+    }
+  }
+
+  if (sorted != stack) {
+    free(sorted);
+  }
+}
+
+
+void lock_queues(Queue *queues[], unsigned int n) {
+
+  lock_queue_set(queues, n, TRUE);
+}
+
+
+void unlock_queues(Queue *queues[], unsigned int n) {
+
+  lock_queue_set(queues, n, FALSE);
+}
+
+
+// lock the queue globally, to allow use of nolock_* functions
+void lock_queue(Queue *q) {
+  
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c lock_queue() **\n");
+    exit(1);
+  }
+  
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+  
+}
+
+// unlock the queue
+void unlock_queue(Queue *q) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c unlock_queue() **\n");
+    exit(1);
+  }
+  
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+  
+}
+
+
+
+
+
+void init_lf_queue(LFQueue *q, unsigned int elementsize, unsigned long capacity) {
+
+  unsigned long i, slots = 1;
+
+  while (slots < capacity) {
+    slots <<= 1;
+  }
+
+  q->slots = (LF_slot *) malloc(slots * sizeof(LF_slot));
+  q->data = (char *) malloc(slots * elementsize);
+  if (q->slots == NULL || q->data == NULL) {
+    fprintf(stderr, "malloc() failed in function init_lf_queue()\n");
+    exit(1);
+  }
+
+  // slot i is initially free for the producer that claims position i
+  for (i = 0; i < slots; i++) {
+    atomic_init(&(q->slots[i].sequence), i);
+  }
+
+  q->capacity = slots;
+  q->mask = slots - 1;
+  q->elementsize = elementsize;
+  atomic_init(&(q->head), 0);
+  atomic_init(&(q->tail), 0);
+  q->magic = LF_QUEUE_MAGIC;
+}
+
+
+int lf_queue_initialized(LFQueue *q) {
+
+  return q->magic == LF_QUEUE_MAGIC;
+
+}
+
+
+void destroy_lf_queue(LFQueue *q) {
+
+  if (q->magic != LF_QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c destroy_lf_queue() **\n");
+    exit(1);
+  }
+
+  free(q->slots);
+  free(q->data);
+  q->slots = NULL;
+  q->data = NULL;
+  q->magic = 0;
+}
+
+
+int lf_add_to_queue(LFQueue *q, void *element, int priority) {
+
+  LF_slot *slot;
+  unsigned long pos, seq;
+  long diff;
+
+  if (q->magic != LF_QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c lf_add_to_queue() **\n");
+    exit(1);
+  }
+
+  pos = atomic_load_explicit(&(q->tail), memory_order_relaxed);
+  for (;;) {
+    slot = &(q->slots[pos & q->mask]);
+    seq = atomic_load_explicit(&(slot->sequence), memory_order_acquire);
+    diff = (long) seq - (long) pos;
+    if (diff == 0) {
+      // slot is free for position 'pos'--try to claim it
+      if (atomic_compare_exchange_weak_explicit(&(q->tail), &pos, pos + 1,
+						memory_order_relaxed,
+						memory_order_relaxed)) {
+	break;
+      }
+    }
+    else if (diff < 0) {
+      // slot still holds the element from one lap ago--queue is full
+      return FALSE;
+    }
+    else {
+      // another producer got here first
+      pos = atomic_load_explicit(&(q->tail), memory_order_relaxed);
+    }
+  }
+
+  memcpy(q->data + (pos & q->mask) * q->elementsize, element, q->elementsize);
+  slot->priority = priority;
+
+  // publish the element to consumers
+  atomic_store_explicit(&(slot->sequence), pos + 1, memory_order_release);
+
+  return TRUE;
+}
+
+
+void *lf_remove_from_front(LFQueue *q, void *element, int *priority) {
+
+  LF_slot *slot;
+  unsigned long pos, seq;
+  long diff;
+
+  if (q->magic != LF_QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c lf_remove_from_front() **\n");
+    exit(1);
+  }
+
+  pos = atomic_load_explicit(&(q->head), memory_order_relaxed);
+  for (;;) {
+    slot = &(q->slots[pos & q->mask]);
+    seq = atomic_load_explicit(&(slot->sequence), memory_order_acquire);
+    diff = (long) seq - (long) (pos + 1);
+    if (diff == 0) {
+      // slot holds the element for position 'pos'--try to claim it
+      if (atomic_compare_exchange_weak_explicit(&(q->head), &pos, pos + 1,
+						memory_order_relaxed,
+						memory_order_relaxed)) {
+	break;
+      }
+    }
+    else if (diff < 0) {
+      // producer hasn't published this position yet--queue is empty
+      return NULL;
+    }
+    else {
+      // another consumer got here first
+      pos = atomic_load_explicit(&(q->head), memory_order_relaxed);
+    }
+  }
+
+  memcpy(element, q->data + (pos & q->mask) * q->elementsize, q->elementsize);
+  if (priority) {
+    *priority = slot->priority;
+  }
+
+  // hand the slot back to producers for the next lap
+  atomic_store_explicit(&(slot->sequence), pos + q->mask + 1, memory_order_release);
+
+  return element;
+}
+
+
+unsigned long lf_queue_length(LFQueue *q) {
+
+  unsigned long head, tail;
+
+  if (q->magic != LF_QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c lf_queue_length() **\n");
+    exit(1);
+  }
+
+  // read head first so a concurrent dequeue can't make tail < head
+  head = atomic_load_explicit(&(q->head), memory_order_acquire);
+  tail = atomic_load_explicit(&(q->tail), memory_order_acquire);
+
+  return tail > head ? tail - head : 0;
+}
+
+
+unsigned int lf_empty_queue(LFQueue *q) {
+
+  if (q->magic != LF_QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c lf_empty_queue() **\n");
+    exit(1);
+  }
+
+  return lf_queue_length(q) == 0;
+}
+
+
+void init_iterator(Queue *q, Queue_iterator *it, unsigned int snapshot) {
+
+  Queue_element ptr;
+  unsigned long i;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c init_iterator() **\n");
+    exit(1);
+  }
+
+  it->q = q;
+  it->current = NULL;
+  it->snapshot = NULL;
+  it->priorities = NULL;
+  it->length = 0;
+  it->index = 0;
+  it->is_snapshot = snapshot;
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  if (snapshot) {
+    it->length = LENGTH(q);
+    if (it->length > 0) {
+      it->snapshot = (char *) malloc(it->length * q->elementsize);
+      it->priorities = (int *) malloc(it->length * sizeof(int));
+      if (it->snapshot == NULL || it->priorities == NULL) {
+	fprintf(stderr, "malloc() failed in function init_iterator()\n");
+	exit(1);
+      }
+      for (ptr = q->queue, i = 0; ptr != NULL; ptr = ptr->next, i++) {
+	memcpy(it->snapshot + i * q->elementsize, ptr->info, q->elementsize);
+	it->priorities[i] = ptr->priority;
+      }
+    }
+  }
+  else {
+    it->current = q->queue;
+  }
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+}
+
+
+void destroy_iterator(Queue_iterator *it) {
+
+  free(it->snapshot);
+  free(it->priorities);
+  it->snapshot = NULL;
+  it->priorities = NULL;
+  it->current = NULL;
+  it->length = 0;
+  it->index = 0;
+}
+
+
+void iterator_rewind(Queue_iterator *it) {
+
+  if (it->q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c iterator_rewind() **\n");
+    exit(1);
+  }
+
+  if (it->is_snapshot) {
+    it->index = 0;
+  }
+  else {
+    // lock entire queue
+    PRIOQUE_LOCK(it->q);
+
+    it->current = it->q->queue;
+
+    // release lock on queue
+    pthread_mutex_unlock(&(it->q->lock));
+  }
+}
+
+
+void iterator_next(Queue_iterator *it) {
+
+  if (it->q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c iterator_next() **\n");
+    exit(1);
+  }
+
+#if defined(CONSISTENCY_CHECKING)
+  if (iterator_end(it)) {
+    fprintf(stderr, "Advance past end--NULL pointer in function iterator_next()\n");
+    exit(1);
+  }
+#endif
+
+  if (it->is_snapshot) {
+    (it->index)++;
+  }
+  else {
+    // lock entire queue
+    PRIOQUE_LOCK(it->q);
+
+    it->current = it->current->next;
+
+    // release lock on queue
+    pthread_mutex_unlock(&(it->q->lock));
+  }
+}
+
+
+unsigned int iterator_end(Queue_iterator *it) {
+
+  if (it->is_snapshot) {
+    return it->index >= it->length;
+  }
+  else {
+    return it->current == NULL;
+  }
+}
+
+
+void *iterator_pointer(Queue_iterator *it) {
+
+  if (iterator_end(it)) {
+    return NULL;
+  }
+  else if (it->is_snapshot) {
+    return it->snapshot + it->index * it->q->elementsize;
+  }
+  else {
+    return it->current->info;
+  }
+}
+
+
+int iterator_priority(Queue_iterator *it) {
+
+#if defined(CONSISTENCY_CHECKING)
+  if (iterator_end(it)) {
+    fprintf(stderr, "NULL pointer in function iterator_priority()\n");
+    exit(1);
+  }
+#endif
+
+  if (it->is_snapshot) {
+    return it->priorities[it->index];
+  }
+  else {
+    return it->current->priority;
+  }
+}
+
+
+Queue_element iterator_handle(Queue_iterator *it) {
+
+#if defined(CONSISTENCY_CHECKING)
+  if (it->is_snapshot) {
+    fprintf(stderr, "Snapshot iterator used in function iterator_handle()\n");
+    exit(1);
+  }
+#endif
+
+  return it->current;
+}
+
+
+void iterator_delete(Queue_iterator *it) {
+
+  Queue_element temp;
+
+  if (it->q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c iterator_delete() **\n");
+    exit(1);
+  }
+
+#if defined(CONSISTENCY_CHECKING)
+  if (it->is_snapshot || it->current == NULL) {
+    fprintf(stderr, "Snapshot iterator or NULL pointer in function iterator_delete()\n");
+    exit(1);
+  }
+#endif
+
+  // lock entire queue
+  PRIOQUE_LOCK(it->q);
+
+  temp = it->current;
+  it->current = temp->next;
+  unlink_element(it->q, temp);
+  free_element(it->q, temp);
+
+  // release lock on queue
+  pthread_mutex_unlock(&(it->q->lock));
+}
+
+
+
+// returns the calling thread's preferred shard in 'sq'
+static unsigned int my_shard(ShardedQueue *sq) {
+
+  if (shard_thread == UINT_MAX) {
+    shard_thread = atomic_fetch_add_explicit(&next_shard_thread, 1, memory_order_relaxed);
+  }
+
+  return shard_thread % sq->nshards;
+}
+
+
+void init_sharded_queue(ShardedQueue *sq, unsigned int elementsize,
+			unsigned int nshards, unsigned int relaxed_order) {
+
+  unsigned int i;
+
+  if (nshards == 0) {
+    nshards = 1;
+  }
+
+  sq->shards = (Queue_shard *) aligned_alloc(_Alignof(Queue_shard),
+					     nshards * sizeof(Queue_shard));
+  if (sq->shards == NULL) {
+    fprintf(stderr, "aligned_alloc() failed in function init_sharded_queue()\n");
+    exit(1);
+  }
+
+  for (i = 0; i < nshards; i++) {
+    init_queue(&(sq->shards[i].q), SHARD_TICKET_SIZE + elementsize, TRUE, NULL, TRUE);
+  }
+
+  sq->nshards = nshards;
+  sq->elementsize = elementsize;
+  sq->relaxed_order = relaxed_order;
+  atomic_init(&(sq->ticket), 0);
+  sq->magic = SHARDED_QUEUE_MAGIC;
+}
+
+
+void destroy_sharded_queue(ShardedQueue *sq) {
+
+  unsigned int i;
+
+  if (sq->magic != SHARDED_QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c destroy_sharded_queue() **\n");
+    exit(1);
+  }
+
+  for (i = 0; i < sq->nshards; i++) {
+    destroy_queue(&(sq->shards[i].q));
+  }
+  free(sq->shards);
+  sq->shards = NULL;
+  sq->magic = 0;
+}
+
+
+void sharded_add_to_queue(ShardedQueue *sq, void *element, int priority) {
+
+  char staging[SHARD_TICKET_SIZE + SHARD_STAGING_SIZE], *buf = staging;
+  unsigned long ticket = 0;
+  Queue *q;
+
+  if (sq->magic != SHARDED_QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c sharded_add_to_queue() **\n");
+    exit(1);
+  }
+
+  if (sq->elementsize > SHARD_STAGING_SIZE) {
+    buf = (char *) malloc(SHARD_TICKET_SIZE + sq->elementsize);
+    if (buf == NULL) {
+      fprintf(stderr, "malloc() failed in function sharded_add_to_queue()\n");
+      exit(1);
+    }
+  }
+  memcpy(buf + SHARD_TICKET_SIZE, element, sq->elementsize);
+
+  q = &(sq->shards[my_shard(sq)].q);
+
+  // lock the shard
+  PRIOQUE_LOCK(q);
+
+  // the ticket is taken with the shard locked, so tickets within a
+  // shard are always increasing from front to rear
+  if (! sq->relaxed_order) {
+    ticket = atomic_fetch_add_explicit(&(sq->ticket), 1, memory_order_relaxed);
+  }
+  memcpy(buf, &ticket, SHARD_TICKET_SIZE);
+  nolock_add_to_queue(q, buf, priority);
+
+  // release lock on shard
+  pthread_mutex_unlock(&(q->lock));
+
+  if (buf != staging) {
+    free(buf);
+  }
+}
+
+
+// removes the front element of shard 'q' into 'element' if its ticket
+// is 'ticket' (or unconditionally, if 'any' is TRUE).  Returns
+// 'element' on success, otherwise NULL.
+static void *remove_from_shard(ShardedQueue *sq, Queue *q, void *element, int *priority,
+			       unsigned long ticket, int any) {
+
+  void *ret = NULL;
+  unsigned long front;
+
+  // lock the shard
+  PRIOQUE_LOCK(q);
+
+  if (q->queue) {
+    memcpy(&front, q->queue->info, SHARD_TICKET_SIZE);
+    if (any || front == ticket) {
+      memcpy(element, (char *) q->queue->info + SHARD_TICKET_SIZE, sq->elementsize);
+      if (priority) {
+	*priority = q->queue->priority;
+      }
+      nolock_delete_handle(q, q->queue);
+      ret = element;
+    }
+  }
+
+  // release lock on shard
+  pthread_mutex_unlock(&(q->lock));
+
+  return ret;
+}
+
+
+void *sharded_remove_from_front(ShardedQueue *sq, void *element, int *priority) {
+
+  unsigned int i, start, oldest_shard;
+  unsigned long ticket, oldest;
+  int found;
+  Queue *q;
+
+  if (sq->magic != SHARDED_QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c sharded_remove_from_front() **\n");
+    exit(1);
+  }
+
+  start = my_shard(sq);
+
+  if (sq->relaxed_order) {
+    // own shard first, then steal round-robin
+    for (i = 0; i < sq->nshards; i++) {
+      q = &(sq->shards[(start + i) % sq->nshards].q);
+      if (! empty_queue(q) && remove_from_shard(sq, q, element, priority, 0, TRUE)) {
+	return element;
+      }
+    }
+    return NULL;
+  }
+
+  for (;;) {
+    // find the shard whose front element has the oldest ticket
+    found = FALSE;
+    oldest = 0;
+    oldest_shard = 0;
+    for (i = 0; i < sq->nshards; i++) {
+      q = &(sq->shards[i].q);
+      if (empty_queue(q)) {
+	continue;
+      }
+      PRIOQUE_LOCK(q);
+      if (q->queue) {
+	memcpy(&ticket, q->queue->info, SHARD_TICKET_SIZE);
+	if (! found || ticket < oldest) {
+	  found = TRUE;
+	  oldest = ticket;
+	  oldest_shard = i;
+	}
+      }
+      pthread_mutex_unlock(&(q->lock));
+    }
+
+    if (! found) {
+      return NULL;
+    }
+
+    // another consumer may have taken it in the meantime--rescan
+    if (remove_from_shard(sq, &(sq->shards[oldest_shard].q), element, priority, oldest, FALSE)) {
+      return element;
+    }
+  }
+}
+
+
+unsigned long sharded_queue_length(ShardedQueue *sq) {
+
+  unsigned long length = 0;
+  unsigned int i;
+
+  if (sq->magic != SHARDED_QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c sharded_queue_length() **\n");
+    exit(1);
+  }
+
+  for (i = 0; i < sq->nshards; i++) {
+    length += queue_length(&(sq->shards[i].q));
+  }
+
+  return length;
+}
+
+
+unsigned int sharded_empty_queue(ShardedQueue *sq) {
+
+  return sharded_queue_length(sq) == 0;
+}
+
+
+
+void init_queue_with_allocator(Queue *q, unsigned int elementsize, unsigned int duplicates,
+			       int (*compare) (const void *e1, const void *e2),
+			       unsigned int priority_is_tag_only,
+			       Queue_allocator *allocator) {
+
+  if (! allocator || ! allocator->alloc) {
+    fprintf(stderr, "prioque.c: init_queue_with_allocator() requires an 'alloc' callback.\n");
+    exit(1);
+  }
+
+  init_queue(q, elementsize, duplicates, compare, priority_is_tag_only);
+  q->allocator = *allocator;
+}
+
+
+// Queue_allocator callback for arena-backed queues
+static void *arena_alloc(size_t size, void *ctx) {
+
+  Queue_arena *arena = (Queue_arena *) ctx;
+  Queue_arena_chunk *chunk;
+  size_t chunksize;
+  void *ptr;
+
+  size = ARENA_ALIGN(size);
+
+  pthread_mutex_lock(&(arena->lock));
+
+  if (arena->next == NULL || (size_t) (arena->end - arena->next) < size) {
+    chunksize = arena->chunksize;
+    if (chunksize < ARENA_ALIGN(sizeof(Queue_arena_chunk)) + size) {
+      chunksize = ARENA_ALIGN(sizeof(Queue_arena_chunk)) + size;
+    }
+    chunk = NULL;
+    if (arena->huge_pages) {
+      chunksize = (chunksize + QUEUE_ARENA_HUGE_PAGE - 1) & ~(QUEUE_ARENA_HUGE_PAGE - 1);
+#if defined(MAP_HUGETLB)
+      chunk = (Queue_arena_chunk *) mmap(NULL, chunksize, PROT_READ | PROT_WRITE,
+					 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+      if (chunk == NULL || chunk == MAP_FAILED) {
+	// no reserved huge pages, so ask for transparent ones
+	chunk = (Queue_arena_chunk *) mmap(NULL, chunksize, PROT_READ | PROT_WRITE,
+					   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#if defined(MADV_HUGEPAGE)
+	if (chunk != MAP_FAILED) {
+	  madvise(chunk, chunksize, MADV_HUGEPAGE);
+	}
+#endif
+      }
+      if (chunk == MAP_FAILED) {
+	chunk = NULL;
+      }
+      else {
+	chunk->mapped = TRUE;
+      }
+    }
+    else {
+      chunk = (Queue_arena_chunk *) malloc(chunksize);
+      if (chunk) {
+	chunk->mapped = FALSE;
+      }
+    }
+    if (chunk == NULL) {
+      pthread_mutex_unlock(&(arena->lock));
+      return NULL;
+    }
+    chunk->size = chunksize;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->next = (char *) chunk + ARENA_ALIGN(sizeof(Queue_arena_chunk));
+    arena->end = (char *) chunk + chunksize;
+  }
+
+  ptr = arena->next;
+  arena->next += size;
+
+  pthread_mutex_unlock(&(arena->lock));
+
+  return ptr;
+}
+
+
+void init_queue_with_arena(Queue *q, unsigned int elementsize, unsigned int duplicates,
+			   int (*compare) (const void *e1, const void *e2),
+			   unsigned int priority_is_tag_only,
+			   Queue_arena *arena) {
+
+  if (arena->magic != QUEUE_ARENA_MAGIC) {
+    fprintf(stderr, "** ARENA NOT INITIALIZED in prioque.c init_queue_with_arena() **\n");
+    exit(1);
+  }
+
+  init_queue(q, elementsize, duplicates, compare, priority_is_tag_only);
+  q->allocator.alloc = arena_alloc;
+  q->allocator.release = NULL;
+  q->allocator.ctx = arena;
+}
+
+
+void init_queue_arena(Queue_arena *arena, size_t chunksize, unsigned int huge_pages) {
+
+  arena->chunks = NULL;
+  arena->next = NULL;
+  arena->end = NULL;
+  arena->chunksize = chunksize;
+  arena->huge_pages = huge_pages;
+  arena->lock = initial_mutex;
+  arena->magic = QUEUE_ARENA_MAGIC;
+}
+
+
+// release one arena chunk
+static void free_arena_chunk(Queue_arena_chunk *chunk) {
+
+  if (chunk->mapped) {
+    munmap(chunk, chunk->size);
+  }
+  else {
+    free(chunk);
+  }
+}
+
+
+void reset_queue_arena(Queue_arena *arena) {
+
+  Queue_arena_chunk *chunk, *next;
+
+  if (arena->magic != QUEUE_ARENA_MAGIC) {
+    fprintf(stderr, "** ARENA NOT INITIALIZED in prioque.c reset_queue_arena() **\n");
+    exit(1);
+  }
+
+  pthread_mutex_lock(&(arena->lock));
+
+  if (arena->chunks) {
+    for (chunk = arena->chunks->next; chunk != NULL; chunk = next) {
+      next = chunk->next;
+      free_arena_chunk(chunk);
+    }
+    arena->chunks->next = NULL;
+    arena->next = (char *) arena->chunks + ARENA_ALIGN(sizeof(Queue_arena_chunk));
+  }
+
+  pthread_mutex_unlock(&(arena->lock));
+}
+
+
+void destroy_queue_arena(Queue_arena *arena) {
+
+  Queue_arena_chunk *chunk, *next;
+
+  if (arena->magic != QUEUE_ARENA_MAGIC) {
+    fprintf(stderr, "** ARENA NOT INITIALIZED in prioque.c destroy_queue_arena() **\n");
+    exit(1);
+  }
+
+  for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    free_arena_chunk(chunk);
+  }
+  arena->chunks = NULL;
+  arena->next = NULL;
+  arena->end = NULL;
+  arena->magic = 0;
+}
+
+
+
+Queue_element nolock_new_element(Queue *q, int priority) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_new_element() **\n");
+    exit(1);
+  }
+
+  return alloc_element(q, NULL, priority);
+}
+
+
+void nolock_link_new_element(Queue *q, Queue_element e) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_link_new_element() **\n");
+    exit(1);
+  }
+
+  e->hash = q->hash ? q->hash(e->info) : 0;
+  link_element(q, e, insertion_point(q, e->priority));
+
+  nolock_rewind_queue(q);
+}
+
+
+Queue_element nolock_unlink_front(Queue *q) {
+
+  Queue_element e;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_unlink_front() **\n");
+    exit(1);
+  }
+
+  e = q->queue;
+  if (e) {
+    unlink_element(q, e);
+  }
+
+  nolock_rewind_queue(q);
+
+  return e;
+}
+
+
+void nolock_free_element(Queue *q, Queue_element e) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c nolock_free_element() **\n");
+    exit(1);
+  }
+
+  free_element(q, e);
+}
+
+
+
+// record the removal of 'e' from 'q' for the next delta snapshot
+static void log_removal(Queue *q, Queue_element e) {
+
+  unsigned long *removed;
+
+  if (q->nremoved == q->removed_size) {
+    q->removed_size = q->removed_size ? q->removed_size * 2 : 64;
+    removed = (unsigned long *) realloc(q->removed, q->removed_size * sizeof(unsigned long));
+    if (removed == NULL) {
+      fprintf(stderr, "realloc() failed in function log_removal()\n");
+      exit(1);
+    }
+    q->removed = removed;
+  }
+
+  q->removed[q->nremoved++] = e->id;
+}
+
+
+void track_queue_changes(Queue *q) {
+
+  Queue_element e;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c track_queue_changes() **\n");
+    exit(1);
+  }
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  q->track_changes = TRUE;
+  q->epoch = 1;
+  q->nremoved = 0;
+  for (e = q->queue; e != NULL; e = e->next) {
+    if (e->id == 0) {
+      e->id = atomic_fetch_add_explicit(&next_element_id, 1, memory_order_relaxed);
+    }
+    e->epoch = q->epoch;
+  }
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+}
+
+
+void mark_handle_dirty(Queue *q, Queue_element h) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c mark_handle_dirty() **\n");
+    exit(1);
+  }
+
+#if defined(CONSISTENCY_CHECKING)
+  if (h == NULL) {
+    fprintf(stderr, "NULL handle in function mark_handle_dirty()\n");
+    exit(1);
+  }
+#endif
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  if (q->track_changes) {
+    h->epoch = q->epoch;
+  }
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+}
+
+
+// encode the snapshot record for element 'e' of 'q' at 'rec'
+static void encode_snapshot_record(Queue *q, Queue_element e, unsigned char *rec) {
+
+  size_t recsize = QUEUE_SNAPSHOT_RECORD_SIZE(q->elementsize);
+
+  put_le(rec, e->id, 8);
+  put_le(rec + 8, e->prev ? e->prev->id : 0, 8);
+  put_le(rec + 16, (uint32_t) e->priority, 4);
+  memset(rec + 20, 0, 4);
+  memcpy(rec + QUEUE_SNAPSHOT_RECORD_HEADER, e->info, q->elementsize);
+  memset(rec + QUEUE_SNAPSHOT_RECORD_HEADER + q->elementsize, 0,
+	 recsize - QUEUE_SNAPSHOT_RECORD_HEADER - q->elementsize);
+}
+
+
+unsigned int save_queue_snapshot(Queue *q, FILE *fp, unsigned int full) {
+
+  unsigned char header[QUEUE_SNAPSHOT_HEADER_SIZE], id[8], *rec;
+  uint64_t checksum = CHECKSUM_INIT, nrecords = 0;
+  size_t recsize;
+  unsigned long i;
+  Queue_element e;
+  unsigned int ret = TRUE;
+  int pass;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c save_queue_snapshot() **\n");
+    exit(1);
+  }
+
+  recsize = QUEUE_SNAPSHOT_RECORD_SIZE(q->elementsize);
+  rec = (unsigned char *) malloc(recsize);
+  if (rec == NULL) {
+    fprintf(stderr, "malloc() failed in function save_queue_snapshot()\n");
+    exit(1);
+  }
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  if (! q->track_changes) {
+    pthread_mutex_unlock(&(q->lock));
+    free(rec);
+    fprintf(stderr, "prioque.c: save_queue_snapshot() requires track_queue_changes().\n");
+    return FALSE;
+  }
+
+  // pass 0 counts and checksums the records, pass 1 writes them.  The
+  // stdio buffer batches the writes.
+  for (pass = 0; ret && pass < 2; pass++) {
+    if (pass == 1) {
+      memset(header, 0, sizeof(header));
+      memcpy(header, "PQSNAP\0", 8);
+      put_le(header + 8, QUEUE_SNAPSHOT_VERSION, 4);
+      put_le(header + 12, host_byte_order(), 4);
+      put_le(header + 16, q->elementsize, 4);
+      put_le(header + 20, full ? QUEUE_SNAPSHOT_FULL : 0, 4);
+      put_le(header + 24, full ? 0 : q->epoch - 1, 8);
+      put_le(header + 32, q->epoch, 8);
+      put_le(header + 40, full ? 0 : q->nremoved, 8);
+      put_le(header + 48, nrecords, 8);
+      put_le(header + 56, checksum, 8);
+      ret = (fwrite(header, sizeof(header), 1, fp) == 1);
+    }
+    for (i = 0; ret && ! full && i < q->nremoved; i++) {
+      put_le(id, q->removed[i], 8);
+      if (pass == 0) {
+	checksum = checksum_bytes(checksum, id, 8);
+      }
+      else {
+	ret = (fwrite(id, 8, 1, fp) == 1);
+      }
+    }
+    for (e = q->queue; ret && e != NULL; e = e->next) {
+      if (! full && e->epoch != q->epoch) {
+	continue;
+      }
+      encode_snapshot_record(q, e, rec);
+      if (pass == 0) {
+	checksum = checksum_bytes(checksum, rec, recsize);
+	nrecords++;
+      }
+      else {
+	ret = (fwrite(rec, recsize, 1, fp) == 1);
+      }
+    }
+  }
+
+  ret = ret && fflush(fp) == 0;
+  if (ret) {
+    q->epoch++;
+    q->nremoved = 0;
+  }
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+
+  free(rec);
+
+  return ret;
+}
+
+
+unsigned int queue_snapshot_elementsize(FILE *fp) {
+
+  unsigned char header[QUEUE_SNAPSHOT_HEADER_SIZE];
+  unsigned int elementsize = 0;
+  long start = ftell(fp);
+
+  if (fread(header, sizeof(header), 1, fp) == 1 &&
+      memcmp(header, "PQSNAP\0", 8) == 0) {
+    elementsize = (unsigned int) get_le(header + 16, 4);
+  }
+  fseek(fp, start, SEEK_SET);
+
+  return elementsize;
+}
+
+
+// open-addressing map from element id to element, used while applying
+// a snapshot.  A slot with an id but a NULL element is a deleted entry.
+typedef struct {
+  unsigned long id;
+  Queue_element e;
+  int known;                                  // in the queue, while checking a snapshot
+} Snapshot_slot;
+
+typedef struct {
+  Snapshot_slot *slots;
+  unsigned long mask;
+} Snapshot_map;
+
+
+// returns the slot for 'id' in 'map': the slot holding it, or the
+// empty slot where it belongs
+static Snapshot_slot *snapshot_slot(Snapshot_map *map, unsigned long id) {
+
+  unsigned long i = (id * 0x9E3779B97F4A7C15UL) & map->mask;
+
+  while (map->slots[i].id != 0 && map->slots[i].id != id) {
+    i = (i + 1) & map->mask;
+  }
+
+  return &(map->slots[i]);
+}
+
+
+// returns TRUE if, applying the snapshot 'body' in order, every
+// record's predecessor is in the queue when the record is linked.
+// Only the 'known' flags of 'map' are changed.
+static unsigned int snapshot_chain_ok(Snapshot_map *map, const unsigned char *body,
+				      uint64_t nremoved, uint64_t nrecords, size_t recsize) {
+
+  const unsigned char *p = body + nremoved * 8;
+  Snapshot_slot *slot;
+  unsigned long i;
+
+  for (i = 0; i < nremoved; i++) {
+    slot = snapshot_slot(map, get_le(body + i * 8, 8));
+    slot->known = FALSE;
+  }
+  for (i = 0; i < nrecords; i++, p += recsize) {
+    // a replaced element is unlinked before its record is linked
+    slot = snapshot_slot(map, get_le(p, 8));
+    slot->id = get_le(p, 8);
+    slot->known = FALSE;
+    if (get_le(p + 8, 8) != 0 && ! snapshot_slot(map, get_le(p + 8, 8))->known) {
+      return FALSE;
+    }
+    slot->known = TRUE;
+  }
+
+  return TRUE;
+}
+
+
+// raise the element id counter above 'id', so ids loaded from a
+// snapshot are never handed out again
+static void reserve_element_id(unsigned long id) {
+
+  unsigned long next = atomic_load_explicit(&next_element_id, memory_order_relaxed);
+
+  while (next <= id &&
+	 ! atomic_compare_exchange_weak_explicit(&next_element_id, &next, id + 1,
+						 memory_order_relaxed, memory_order_relaxed)) {
+  }
+}
+
+
+unsigned int apply_queue_snapshot(Queue *q, FILE *fp) {
+
+  unsigned char header[QUEUE_SNAPSHOT_HEADER_SIZE], *body, *p;
+  uint64_t base, epoch, nremoved, nrecords, checksum;
+  unsigned long i, id, slots;
+  size_t recsize, bodysize;
+  Snapshot_slot *slot;
+  Snapshot_map map;
+  Queue_element e, temp, after;
+  int full;
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c apply_queue_snapshot() **\n");
+    exit(1);
+  }
+
+  if (fread(header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header, "PQSNAP\0", 8) != 0) {
+    fprintf(stderr, "prioque.c: not a queue snapshot.\n");
+    return FALSE;
+  }
+  if (get_le(header + 8, 4) != QUEUE_SNAPSHOT_VERSION ||
+      get_le(header + 12, 4) != host_byte_order() ||
+      get_le(header + 16, 4) != q->elementsize) {
+    fprintf(stderr, "prioque.c: queue snapshot version, byte order or element size doesn't match.\n");
+    return FALSE;
+  }
+
+  full = (get_le(header + 20, 4) & QUEUE_SNAPSHOT_FULL) != 0;
+  base = get_le(header + 24, 8);
+  epoch = get_le(header + 32, 8);
+  nremoved = get_le(header + 40, 8);
+  nrecords = get_le(header + 48, 8);
+  checksum = get_le(header + 56, 8);
+  recsize = QUEUE_SNAPSHOT_RECORD_SIZE(q->elementsize);
+
+  if (nremoved > SIZE_MAX / 16 || nrecords > (SIZE_MAX / 2) / recsize) {
+    fprintf(stderr, "prioque.c: queue snapshot is too large.\n");
+    return FALSE;
+  }
+
+  // snapshots hold only the changes, so the body is read whole
+  bodysize = nremoved * 8 + nrecords * recsize;
+  body = (unsigned char *) malloc(bodysize + 1);
+  if (body == NULL) {
+    fprintf(stderr, "prioque.c: out of memory reading queue snapshot.\n");
+    return FALSE;
+  }
+  if (fread(body, 1, bodysize, fp) != bodysize ||
+      checksum_bytes(CHECKSUM_INIT, body, bodysize) != checksum) {
+    fprintf(stderr, "prioque.c: queue snapshot is truncated or its checksum doesn't match.\n");
+    free(body);
+    return FALSE;
+  }
+
+  // lock entire queue
+  PRIOQUE_LOCK(q);
+
+  if (! full && (! q->track_changes || q->epoch != base + 1)) {
+    pthread_mutex_unlock(&(q->lock));
+    free(body);
+    fprintf(stderr, "prioque.c: delta snapshot for epoch %lu doesn't follow the queue's epoch.\n",
+	    (unsigned long) base);
+    return FALSE;
+  }
+
+  // map every element that may be referred to by id.  A full
+  // snapshot replaces the whole queue, so none of its elements may be.
+  for (slots = 16; slots < 2 * ((full ? 0 : LENGTH(q)) + nrecords); slots *= 2) {
+  }
+  map.slots = (Snapshot_slot *) calloc(slots, sizeof(Snapshot_slot));
+  if (map.slots == NULL) {
+    pthread_mutex_unlock(&(q->lock));
+    free(body);
+    fprintf(stderr, "prioque.c: out of memory applying queue snapshot.\n");
+    return FALSE;
+  }
+  map.mask = slots - 1;
+  for (e = full ? NULL : q->queue; e != NULL; e = e->next) {
+    slot = snapshot_slot(&map, e->id);
+    slot->id = e->id;
+    slot->e = e;
+    slot->known = TRUE;
+  }
+
+  // the queue is left alone unless the whole snapshot can be applied
+  if (! snapshot_chain_ok(&map, body, nremoved, nrecords, recsize)) {
+    pthread_mutex_unlock(&(q->lock));
+    free(map.slots);
+    free(body);
+    fprintf(stderr, "prioque.c: queue snapshot refers to an element that isn't in the queue.\n");
+    return FALSE;
+  }
+
+  // replaced elements are relinked at once, so watermarks are checked
+  // once, on the final length
+  q->hold_watermarks = TRUE;
+  if (full) {
+    nolock_destroy_queue(q);
+  }
+  // the snapshot's own changes aren't changes to be saved again
+  q->track_changes = FALSE;
+
+  p = body;
+  for (i = 0; i < nremoved; i++, p += 8) {
+    slot = snapshot_slot(&map, get_le(p, 8));
+    if (slot->id != 0 && slot->e != NULL) {
+      temp = slot->e;
+      slot->e = NULL;
+      unlink_element(q, temp);
+      free_element(q, temp);
+    }
+  }
+
+  for (i = 0; i < nrecords; i++, p += recsize) {
+    id = get_le(p, 8);
+    slot = snapshot_slot(&map, id);
+    if (slot->id != 0 && slot->e != NULL) {
+      // an element that changed or moved is replaced
+      temp = slot->e;
+      slot->e = NULL;
+      unlink_element(q, temp);
+      free_element(q, temp);
+    }
+    // checked by snapshot_chain_ok()
+    after = get_le(p + 8, 8) != 0 ? snapshot_slot(&map, get_le(p + 8, 8))->e : NULL;
+    e = alloc_element(q, p + QUEUE_SNAPSHOT_RECORD_HEADER, (int) (uint32_t) get_le(p + 16, 4));
+    e->id = id;
+    link_element(q, e, after);
+    reserve_element_id(id);
+    slot = snapshot_slot(&map, id);
+    slot->id = id;
+    slot->e = e;
+  }
+
+  free(map.slots);
+  free(body);
+
+  q->track_changes = TRUE;
+  q->epoch = epoch + 1;
+  q->nremoved = 0;
+  q->hold_watermarks = FALSE;
+  if (q->watermark) {
+    check_watermarks(q);
+  }
+  nolock_rewind_queue(q);
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+
+  return TRUE;
+}
+
+
+void queue_stats(Queue *q, Queue_stats *stats) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c queue_stats() **\n");
+    exit(1);
+  }
+
+#if defined(PRIOQUE_STATS)
+  // lock entire queue, without counting the acquisition
+  pthread_mutex_lock(&(q->lock));
+
+  *stats = q->stats;
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+#else
+  memset(stats, 0, sizeof(Queue_stats));
+#endif
+}
+
+
+void reset_queue_stats(Queue *q) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c reset_queue_stats() **\n");
+    exit(1);
+  }
+
+#if defined(PRIOQUE_STATS)
+  // lock entire queue, without counting the acquisition
+  pthread_mutex_lock(&(q->lock));
+
+  memset(&(q->stats), 0, sizeof(Queue_stats));
+  q->stats.peak_length = LENGTH(q);
+
+  // release lock on queue
+  pthread_mutex_unlock(&(q->lock));
+#endif
+}
+
+
+void report_queue_stats(Queue *q, const char *name) {
+
+  if (q->magic != QUEUE_MAGIC) {
+    fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.c report_queue_stats() **\n");
+    exit(1);
+  }
+
+#if defined(PRIOQUE_STATS)
+  Stats_report *r, **link;
+
+  r = (Stats_report *) malloc(sizeof(Stats_report));
+  if (r == NULL) {
+    fprintf(stderr, "malloc() failed in function report_queue_stats()\n");
+    exit(1);
+  }
+  r->q = q;
+  r->name = name;
+  r->next = NULL;
+
+  pthread_mutex_lock(&stats_reports_lock);
+  if (stats_reports == NULL) {
+    atexit(dump_stats_at_exit);
+  }
+  // keep registration order in the report
+  for (link = &stats_reports; *link != NULL; link = &((*link)->next)) {
+  }
+  *link = r;
+  pthread_mutex_unlock(&stats_reports_lock);
+#else
+  (void) name;
+#endif
+}
+
+
+void dump_queue_stats(FILE *fp) {
+
+#if defined(PRIOQUE_STATS)
+  Stats_report *r;
+  Queue_stats stats;
+
+  pthread_mutex_lock(&stats_reports_lock);
+  for (r = stats_reports; r != NULL; r = r->next) {
+    if (r->q) {
+      queue_stats(r->q, &stats);
+    }
+    else {
+      stats = r->stats;
+    }
+    fprintf(fp, "prioque %-16s adds %lu removes %lu scan_steps %lu compares %lu "
+	    "allocs %lu frees %lu locks %lu contended %lu peak_length %lu\n",
+	    r->name, stats.adds, stats.removes, stats.scan_steps, stats.compares,
+	    stats.allocs, stats.frees, stats.locks, stats.contended, stats.peak_length);
+  }
+  pthread_mutex_unlock(&stats_reports_lock);
+#else
+  (void) fp;
+#endif
+}
+
+
+#if defined(PRIOQUE_STATS)
+// keep the final counters of 'q' for the exit report, since 'q' may
+// be reused or go out of scope once destroyed
+static void detach_stats_report(Queue *q) {
+
+  Stats_report *r;
+  Queue_stats stats;
+
+  queue_stats(q, &stats);
+
+  pthread_mutex_lock(&stats_reports_lock);
+  for (r = stats_reports; r != NULL; r = r->next) {
+    if (r->q == q) {
+      r->q = NULL;
+      r->stats = stats;
+    }
+  }
+  pthread_mutex_unlock(&stats_reports_lock);
+}
+
+
+// atexit() handler for report_queue_stats()
+static void dump_stats_at_exit(void) {
+
+  Stats_report *r;
+
+  dump_queue_stats(stderr);
+
+  while (stats_reports != NULL) {
+    r = stats_reports;
+    stats_reports = r->next;
+    free(r);
+  }
+}
+#endif
@@ -57,6 +57,115 @@
 // control over queue thread safety via the nolock_* versions of the
 // queueing functions.
 //
+// October 2026: Added a lock-free, bounded, multi-producer /
+// multi-consumer FIFO (LFQueue, see Section 4).  It lives alongside
+// the mutex-protected Queue and has its own entry points.  Slots are
+// preallocated when the queue is initialized, so no memory is freed
+// while other threads can still see it.
+//
+// October 2026: Added init_queue_hashed().  The caller supplies a
+// hash function in addition to 'compare'.  The queue then keeps a
+// side index, so duplicate detection, element_in_queue() and
+// delete_from_queue() are O(1) instead of linear scans.  Queue
+// elements are now doubly linked so that an element found through
+// the index can be unlinked without a search for its predecessor.
+// Fixed a stray unlock in nolock_delete_from_queue().
+//
+// October 2026: Added element handles.  add_to_queue_handle() returns
+// the queue element itself, which can later be deleted with
+// delete_handle() or spliced into another queue with move_handle(),
+// both in O(1) and without copying.  rotate_queue() moves the front
+// element to the rear in O(1) for round-robin use.
+//
+// October 2026: Added iterator objects (Queue_iterator, Section 5).
+// Each one keeps its own position, so nested loops and multiple
+// threads no longer fight over the queue's shared current position.
+// Snapshot iterators copy the queue under a single lock acquisition
+// and can then be walked without holding the lock at all.
+//
+// October 2026: Added batch operations add_many(), remove_up_to_n()
+// and drain_into().  Each takes the queue lock(s) once for the whole
+// batch.  A batch of non-increasing priorities is merged into a
+// prioritized queue in a single pass.  Element data now shares one
+// allocation with its queue element, halving mallocs.
+//
+// October 2026: copy_queue() and merge_queues() now make a single
+// pass over each queue instead of re-adding every element from the
+// front.  drain_into() splices the entire list in O(1) when the
+// destination is a FIFO queue (or the drained elements all belong at
+// its rear) with duplicates allowed and no hash index.
+//
+// October 2026: Removed the package-wide global lock.  Functions that
+// operate on two queues now lock only those two queues, always in
+// address order, so unrelated multi-queue operations run in parallel
+// without risk of deadlock.  Added lock_queues() and unlock_queues()
+// so callers can do atomic multi-queue transactions with the nolock_*
+// functions, e.g. nolock_move_handle().
+//
+// October 2026: The queue length is now an atomic counter, and
+// empty_queue() and queue_length() read it without taking the queue
+// lock.
+//
+// October 2026: Added remove_from_front_wait(), which blocks until an
+// element is available or a timeout expires.  Also added
+// wakeup_queue() and close_queue(), so producers can release waiting
+// consumers and signal end of stream.
+//
+// October 2026: Added sharded queues (ShardedQueue, Section 6) for
+// heavily contended FIFO use.  A sharded queue spreads elements over
+// several cache-line-aligned Queues, so producers on different
+// threads usually take different locks.
+//
+// October 2026: Added allocator hooks and arenas (Section 7).
+// init_queue_with_allocator() takes caller-supplied callbacks for
+// element storage.  init_queue_with_arena() takes elements from a
+// Queue_arena, a chunked bump allocator that can be backed by huge
+// pages.  Destroying an arena-backed queue is O(1), and all of its
+// storage is released at once with the arena.
+//
+// October 2026: Added DEFINE_PRIOQUE() (Section 8), which generates a
+// family of typed static inline operations for queues of one element
+// type.  Element copies are fixed-size assignments, and element
+// comparison is inlined.  Typed queues are ordinary Queues, so the
+// typed and generic functions can be mixed on the same queue.
+//
+// October 2026: Added bounded queues.  set_queue_capacity() caps a
+// queue.  try_add_to_queue() fails instead of exceeding the cap, and
+// add_to_queue_wait() blocks (with an optional timeout) until there
+// is room.  set_queue_watermarks() registers a callback that fires
+// when the queue length crosses a high and then a low watermark, so
+// a producer can throttle itself.
+//
+// October 2026: Added update_front(), update_handle() and
+// update_matching().  They run a caller-supplied callback on queue
+// elements with the queue locked.  The callback may modify the element
+// and its priority, and it decides whether the element stays, is
+// removed, or is requeued.  This generalizes remove_from_front_sync()
+// to arbitrary read-modify-write transactions.
+//
+// October 2026: Added save_queue(), load_queue() and
+// load_queue_mmap().  They use a versioned file format: a fixed
+// little-endian header records the element size, element count, byte
+// order and a checksum, followed by fixed-size element records.
+// Elements are written and read in large buffered blocks, with no
+// per-element callbacks.  serialize_queue() and deserialize_queue()
+// are unchanged.
+//
+// October 2026: Added change tracking and delta snapshots.  After
+// track_queue_changes(), a queue records which elements were added,
+// moved, updated or removed since its last snapshot.
+// save_queue_snapshot() can then write only those changes, and
+// apply_queue_snapshot() replays them.  prioque-compact folds a chain
+// of delta snapshots into a new full snapshot.
+//
+// October 2026: Added optional instrumentation (Section 9).  When
+// everything is compiled with -DPRIOQUE_STATS, each queue counts adds,
+// removes, list-walk steps, compare calls, element allocations and
+// frees, lock acquisitions and contended lock waits, and its peak
+// length.  queue_stats() reads the counters, and report_queue_stats()
+// names a queue for a dump to stderr at exit.  Without PRIOQUE_STATS
+// the counters are compiled out entirely.
+//
 
 // for queue serialization / deserialization--this type is used
 // frequently in some external packages that depend on prioque and a
@@ -73,6 +182,8 @@ typedef enum StateSerialization {
 #define QUEUE_TYPE_DEFINED
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <unistd.h>
@@ -81,28 +192,159 @@ typedef enum StateSerialization {
 #define  FALSE 0
 #define CONSISTENCY_CHECKING 1
 
-// type of one element in a queue 
+// stored in every initialized Queue
+#define QUEUE_MAGIC 0xC0FFEEC0FFEE
+
+// used to keep independently updated fields on separate cache lines
+#define PRIOQUE_CACHE_LINE 64
+
+// type of one element in a queue.  A Queue_element returned by
+// add_to_queue_handle() or current_handle() serves as a stable handle
+// for the element until it is deleted.
 typedef struct _Queue_element {
   void *info;
   int priority;
   struct _Queue_element *next;
+  struct _Queue_element *prev;
+  struct _Queue_element *hnext;                      // next element in same hash bucket
+  unsigned long hash;                                // cached hash of 'info' for hashed queues
+  unsigned long id;                                  // snapshot identity, 0 until tracked
+  unsigned long epoch;                               // snapshot epoch of last change, if tracked
 } *Queue_element;
 
+// element storage callbacks for a queue (see Section 7).  'alloc'
+// returns 'size' bytes aligned for any type, or NULL on failure.  If
+// 'release' is NULL, the memory is owned by the allocator as a whole
+// and is never returned element by element.
+typedef struct Queue_allocator {
+  void *(*alloc) (size_t size, void *ctx);
+  void (*release) (void *ptr, void *ctx);
+  void *ctx;                                         // passed to 'alloc' and 'release'
+} Queue_allocator;
+
+// one chunk of a queue arena; chunk memory follows the header
+typedef struct _Queue_arena_chunk {
+  struct _Queue_arena_chunk *next;                   // next older chunk
+  size_t size;                                       // total size, including this header
+  unsigned int mapped;                               // if TRUE, from mmap() rather than malloc()
+} Queue_arena_chunk;
+
+// chunked bump allocator for queue elements (see Section 7)
+typedef struct Queue_arena {
+  Queue_arena_chunk *chunks;                         // newest chunk first
+  char *next;                                        // first free byte in newest chunk
+  char *end;                                         // end of newest chunk
+  size_t chunksize;                                  // size of a regular chunk
+  unsigned int huge_pages;                           // if TRUE, try to back chunks with huge pages
+  pthread_mutex_t lock;                              // arenas may be shared by several queues
+  unsigned long magic;                               // set on initialization
+} Queue_arena;
+
+// what an update callback wants done with the element it was given
+// (see update_front())
+typedef enum Queue_action {
+  QUEUE_KEEP, QUEUE_REMOVE, QUEUE_REQUEUE
+} Queue_action;
+
+// instrumentation counters for a queue (see Section 9)
+typedef struct Queue_stats {
+  unsigned long adds;                                // elements linked into the queue
+  unsigned long removes;                             // elements unlinked from the queue
+  unsigned long scan_steps;                          // elements visited by linear list walks
+  unsigned long compares;                            // calls to the element comparison function
+  unsigned long allocs;                              // element allocations (not free list reuse)
+  unsigned long frees;                               // element releases (not free list recycling)
+  unsigned long locks;                               // acquisitions of the queue lock
+  unsigned long contended;                           // acquisitions that had to wait
+  unsigned long peak_length;                         // largest queue length seen
+} Queue_stats;
+
 // basic queue type 
 typedef struct Queue {
   Queue_element queue;		                     // head of queue
   Queue_element tail;                                // tail of queue
   Queue_element current;	                     // current position for sequential access functions 
   Queue_element previous;	                     // one step back from current 
-  unsigned long queuelength;	                     // # of elements in queue 
+  atomic_ulong queuelength;	                     // # of elements in queue, see queue_length()
   unsigned int elementsize;	                     // 'sizeof()' one element 
   unsigned int duplicates;	                     // are duplicates allowed? 
   int (*compare) (const void *e1, const void *e2);   // element comparision function 
   pthread_mutex_t lock;                              // lock on queue operations
+  pthread_cond_t nonempty;                           // signaled when elements are added
+  unsigned int waiters;                              // # of threads blocked in remove_from_front_wait()
+  unsigned long wakeups;                             // incremented by wakeup_queue()
+  unsigned int closed;                               // set by close_queue()
+  unsigned long capacity;                            // max # of elements for bounded adds, 0 if unbounded
+  pthread_cond_t notfull;                            // signaled when elements are removed
+  unsigned int full_waiters;                         // # of threads blocked in add_to_queue_wait()
+  unsigned long high_watermark;                      // see set_queue_watermarks()
+  unsigned long low_watermark;
+  void (*watermark) (struct Queue *q, unsigned int high, void *ctx);
+  void *watermark_ctx;                               // passed to 'watermark'
+  unsigned int above_watermark;                      // TRUE between high and low crossings
+  unsigned int hold_watermarks;                      // TRUE while elements are only being repositioned
+  unsigned int track_changes;                        // set by track_queue_changes()
+  unsigned long epoch;                               // current snapshot epoch, starting at 1
+  unsigned long *removed;                            // ids removed during this epoch
+  unsigned long nremoved;                            // # of ids in 'removed'
+  unsigned long removed_size;                        // allocated size of 'removed'
   int priority_is_tag_only;                          // if TRUE, ignore priority and use strict FIFO
+  unsigned long (*hash) (const void *e);             // element hash function, NULL if not hashed
+  Queue_element *buckets;                            // hash index, allocated on first insert
+  unsigned long nbuckets;                            // # of buckets in hash index, power of 2
+  Queue_allocator allocator;                         // element storage, malloc() if 'alloc' is NULL
+  Queue_element freelist;                            // recycled elements if 'release' is NULL
+#if defined(PRIOQUE_STATS)
+  Queue_stats stats;                                 // see Section 9
+#endif
   unsigned long magic;                               // set on initialization 
 } Queue;
 
+// one slot in a lock-free queue.  'sequence' tells producers and
+// consumers whose turn it is to use the slot.
+typedef struct _LF_slot {
+  atomic_ulong sequence;
+  int priority;
+} LF_slot;
+
+// lock-free bounded MPMC FIFO queue (see Section 4)
+typedef struct LFQueue {
+  LF_slot *slots;                                    // per-slot sequence numbers
+  char *data;                                        // element storage, 'capacity' * 'elementsize' bytes
+  unsigned long capacity;                            // # of slots, always a power of 2
+  unsigned long mask;                                // capacity - 1
+  unsigned int elementsize;                          // 'sizeof()' one element
+  unsigned long magic;                               // set on initialization
+  _Alignas(PRIOQUE_CACHE_LINE) atomic_ulong tail;    // next position to enqueue
+  _Alignas(PRIOQUE_CACHE_LINE) atomic_ulong head;    // next position to dequeue
+} LFQueue;
+
+// one cache-line-aligned sub-queue of a sharded queue
+typedef struct _Queue_shard {
+  _Alignas(PRIOQUE_CACHE_LINE) Queue q;
+} Queue_shard;
+
+// sharded FIFO queue (see Section 6)
+typedef struct ShardedQueue {
+  Queue_shard *shards;                               // 'nshards' sub-queues
+  unsigned int nshards;                              // # of sub-queues
+  unsigned int elementsize;                          // 'sizeof()' one element
+  unsigned int relaxed_order;                        // if TRUE, only per-producer FIFO order
+  unsigned long magic;                               // set on initialization
+  _Alignas(PRIOQUE_CACHE_LINE) atomic_ulong ticket;  // global arrival order, unless relaxed
+} ShardedQueue;
+
+// per-caller iterator over a queue (see Section 5)
+typedef struct Queue_iterator {
+  Queue *q;                                          // queue being iterated
+  Queue_element current;                             // position for live iterators
+  char *snapshot;                                    // element data for snapshot iterators, else NULL
+  int *priorities;                                   // priorities for snapshot iterators
+  unsigned long length;                              // # of elements in snapshot
+  unsigned long index;                               // position in snapshot
+  unsigned int is_snapshot;                          // TRUE for snapshot iterators
+} Queue_iterator;
+
 
 ///////////////////////////////////////////////////////////////////////
 //
@@ -134,6 +376,18 @@ void init_queue(Queue *q, unsigned int elementsize, unsigned int duplicates,
 		 int (*compare) (const void *e1, const void *e2),
 		 unsigned int priority_is_tag_only);
 
+// same as init_queue(), but the queue also maintains a hash index on
+// its elements.  'hash' must return equal values for any two elements
+// that 'compare' considers a match.  With the index, duplicate
+// detection, element_in_queue() and delete_from_queue() run in O(1)
+// expected time rather than scanning the queue.  'compare' is
+// required.  A hashed queue keeps its index after it empties, so call
+// destroy_queue() to release all of its storage.
+void init_queue_hashed(Queue *q, unsigned int elementsize, unsigned int duplicates,
+		       int (*compare) (const void *e1, const void *e2),
+		       unsigned long (*hash) (const void *e),
+		       unsigned int priority_is_tag_only);
+
 // returns TRUE if init_queue() has been called on 'q', otherwise
 // FALSE.
 int queue_initialized(Queue q);
@@ -153,6 +407,41 @@ void destroy_queue(Queue *q);
 void add_to_queue(Queue *q, void *element, int priority);
 
 
+// same as add_to_queue(), but returns a handle for the new element.
+// Returns NULL if the element was a duplicate and was not added.
+Queue_element add_to_queue_handle(Queue *q, void *element, int priority);
+
+
+// returns a pointer to the data stored in the element with handle
+// 'h'.  The pointer stays valid until the element is deleted, even if
+// the element is moved to another queue with move_handle().
+void *pointer_to_handle(Queue_element h);
+
+
+// deletes the element with handle 'h' from 'q' in O(1).  If 'h' is
+// the current element, the current position moves to the following
+// element, as for delete_current().
+void delete_handle(Queue *q, Queue_element h);
+
+
+// moves the element with handle 'h' from queue 'from' to queue 'to'
+// with position based on 'priority', as for add_to_queue().  The
+// element is relinked, not copied, and the handle remains valid.  The
+// two queues must have the same element size.  If 'to' doesn't allow
+// duplicates and already contains a matching element, the element is
+// deleted and NULL is returned, otherwise 'h' is returned.  The
+// current position in 'from' is adjusted as for delete_handle() and
+// 'to' is rewound.
+Queue_element move_handle(Queue *to, Queue *from, Queue_element h, int priority);
+
+
+// moves the element at the front of 'q' to the rear in O(1), so
+// repeated calls visit the elements round-robin.  For prioritized
+// queues the element moves behind the last element of equal
+// priority.  Rewinds 'q'.
+void rotate_queue(Queue *q);
+
+
 // removes the element at the front of the 'q' and places it in
 // 'element'.  If the queue is empty, returns NULL, otherwise a
 // non-NULL value.
@@ -167,12 +456,138 @@ void *remove_from_front_sync(Queue *q, void *element,
 			     atomic_uint *j, int change);
 
 
+// Update callbacks.  update_front(), update_handle() and
+// update_matching() call 'fn(element, &priority, ctx)' with the queue
+// locked.  'element' points to the element data in the queue, and
+// 'priority' holds its priority.  The callback may change both, then
+// returns:
+//
+//   QUEUE_KEEP     leave the element in place (but in a prioritized
+//                  queue, an element whose priority changed is moved
+//                  to its new position, as for QUEUE_REQUEUE)
+//   QUEUE_REMOVE   delete the element
+//   QUEUE_REQUEUE  move the element to the rear of the elements with
+//                  its (new) priority
+//
+// The callback must not call locking functions on the queue, and must
+// not turn an element into a duplicate of another in a queue that
+// disallows duplicates.
+typedef Queue_action (*Queue_updater) (void *element, int *priority, void *ctx);
+
+// calls 'fn' on the element at the front of 'q' and applies the
+// action it returns.  Returns that action, or -1 if 'q' is empty.
+int update_front(Queue *q, Queue_updater fn, void *ctx);
+
+// calls 'fn' on the element with handle 'h' in 'q' and applies the
+// action it returns.  Returns that action.  If the element is
+// removed, 'h' is no longer valid.
+int update_handle(Queue *q, Queue_element h, Queue_updater fn, void *ctx);
+
+// calls 'fn' on every element of 'q' that matches 'element' according
+// to the 'compare' function (on every element if 'element' is NULL),
+// from front to rear, and applies the action it returns.  Requeued
+// elements are visited only once.  Returns the number of elements
+// visited.
+unsigned long update_matching(Queue *q, void *element, Queue_updater fn, void *ctx);
+
+
+// adds the 'n' elements stored contiguously at 'elements' to 'q', as
+// if by 'n' calls to add_to_queue(), but locks the queue only once.
+// 'priorities' holds one priority per element, or may be NULL to add
+// every element with priority 0.  If the priorities are in
+// non-increasing order, a prioritized queue merges the whole batch in
+// one pass over the queue.  Returns the number of elements added,
+// which is less than 'n' only if duplicates were dropped.
+unsigned long add_many(Queue *q, void *elements, int *priorities, unsigned long n);
+
+
+// removes up to 'n' elements from the front of 'q' and stores them
+// contiguously at 'elements'.  If 'priorities' is not NULL, their
+// priorities are stored there.  Locks the queue only once.  Returns
+// the number of elements removed.
+unsigned long remove_up_to_n(Queue *q, void *elements, int *priorities, unsigned long n);
+
+
+// moves every element of 'from' into 'to', keeping each element's
+// priority.  Elements are relinked, not copied, and 'from' is left
+// empty.  The queues must have the same element size.  Duplicates are
+// dropped if 'to' doesn't allow them.  Returns the number of elements
+// added to 'to'.  If 'to' allows duplicates, has no hash index, and
+// every element of 'from' belongs at its rear (always true for FIFO
+// 'to'), the whole list is spliced in O(1).
+unsigned long drain_into(Queue *to, Queue *from);
+
+
+// removes the element at the front of the 'q' and places it in
+// 'element', waiting for an element to be added if the queue is
+// empty.  Waits at most 'timeout_ms' milliseconds, or indefinitely if
+// 'timeout_ms' is negative.  Returns a non-NULL value if an element
+// was removed.  Returns NULL if the timeout expired, if wakeup_queue()
+// was called while waiting, or if the queue is closed and empty.
+void *remove_from_front_wait(Queue *q, void *element, long timeout_ms);
+
+
+// wakes every thread waiting in remove_from_front_wait() or
+// add_to_queue_wait() on 'q'.  Threads that find no element (or no
+// room) return without one.
+void wakeup_queue(Queue *q);
+
+
+// marks 'q' as closed, to signal end of stream, and wakes every
+// waiting thread.  Elements can still be added and removed, but
+// remove_from_front_wait() no longer blocks on a closed, empty queue,
+// and add_to_queue_wait() fails on a closed queue.  init_queue()
+// reopens a queue.
+void close_queue(Queue *q);
+
+
+// returns TRUE if close_queue() has been called on 'q', otherwise
+// FALSE.
+unsigned int queue_closed(Queue *q);
+
+
+// limits 'q' to 'capacity' elements for try_add_to_queue() and
+// add_to_queue_wait().  A capacity of 0 (the default) means unbounded.
+// Other ways of adding elements (add_to_queue(), move_handle(),
+// drain_into(), ...) ignore the capacity, so that transfers between
+// queues never block or fail.
+void set_queue_capacity(Queue *q, unsigned long capacity);
+
+
+// same as add_to_queue(), but if 'q' is bounded and full, returns
+// FALSE without adding 'element'.  Otherwise returns TRUE.
+int try_add_to_queue(Queue *q, void *element, int priority);
+
+
+// same as add_to_queue(), but if 'q' is bounded and full, waits until
+// an element is removed.  Waits at most 'timeout_ms' milliseconds, or
+// indefinitely if 'timeout_ms' is negative.  Returns TRUE if
+// 'element' was added.  Returns FALSE if the timeout expired, if
+// wakeup_queue() was called while waiting, or if the queue is closed.
+int add_to_queue_wait(Queue *q, void *element, int priority, long timeout_ms);
+
+
+// registers 'callback' to be called when the length of 'q' rises to
+// 'high' elements (with 'high' TRUE), and again when it next falls to
+// 'low' elements (with 'high' FALSE), and so on.  'ctx' is passed to
+// the callback.  The callback runs with 'q' locked, so it must not
+// call locking functions on 'q'.  Operations that only reposition
+// elements (rotating, requeuing, changing priorities, moving within
+// 'q') don't call it.  A NULL 'callback' removes the watermarks.
+// 'low' must be less than 'high'.
+void set_queue_watermarks(Queue *q, unsigned long high, unsigned long low,
+			  void (*callback) (Queue *q, unsigned int high, void *ctx),
+			  void *ctx);
+
+
 // returns TRUE if the 'element' exists in the 'q', otherwise false.
 // The 'compare' function is used for matching.  As a side-effect, the
 // current position in the queue is set to matching element, so
 // 'update_current()' can be used to update the value of the
 // 'element'.  If the element is not found, the current position is
-// set to the first element in the queue.
+// set to the first element in the queue.  For hashed queues that
+// allow duplicates, any one of several matching elements may be
+// chosen.
 unsigned int element_in_queue(Queue *q, void *element);
 
 
@@ -182,15 +597,24 @@ unsigned int element_in_queue(Queue *q, void *element);
 int delete_from_queue(Queue *q, void *element);
 
 
-// returns TRUE if 'q' is empty, FALSE otherwise.
+// returns TRUE if 'q' is empty, FALSE otherwise.  Does not lock the
+// queue--see queue_length().
 unsigned int empty_queue(Queue *q);
 
 
-// returns the number of elements in the 'q'.
+// returns the number of elements in the 'q'.  Does not lock the
+// queue.  The length is only changed with the queue lock held, using
+// a release store made after the elements have been linked or
+// unlinked.  This function reads it with an acquire load, so the
+// result is a value the length really had.  With concurrent updates
+// it may already be stale when it is returned, so to atomically check
+// for and remove an element use remove_from_front(), which returns
+// NULL if the queue is empty.
 unsigned long queue_length(Queue *q);
 
 
-// makes a copy of 'q2' into 'q1'.  'q2' is not modified.
+// makes a copy of 'q2' into 'q1'.  'q2' is not modified.  Runs in
+// time linear in the length of 'q2'.
 void copy_queue(Queue *q1, Queue *q2);
 
 
@@ -201,7 +625,9 @@ void copy_queue(Queue *q1, Queue *q2);
 unsigned int equal_queues(Queue *q1, Queue *q2);
 
 
-// merge 'q2' into 'q1'.   'q2' is not modified.
+// merge 'q2' into 'q1'.   'q2' is not modified.  If 'q1' allows
+// duplicates and both queues are prioritized, or 'q1' is FIFO, this
+// is a single linear pass over both queues.
 void merge_queues(Queue *q1, Queue *q2);
 
 
@@ -235,6 +661,120 @@ unsigned int deserialize_queue(Queue *q,
 			       FILE *fp);
 
 
+// Queue files.  save_queue() writes a queue whose elements are plain
+// fixed-size data (no pointers to other memory) in a versioned
+// container:
+//
+//   header (48 bytes, all fields little-endian)
+//     0  "PRIOQUE\0"
+//     8  format version (QUEUE_FILE_VERSION)
+//    12  byte order of element data (1 = little-endian, 2 = big-endian)
+//    16  element size
+//    20  flags (QUEUE_FILE_DUPLICATES, QUEUE_FILE_TAG_ONLY)
+//    24  element count
+//    32  checksum (64-bit FNV-1a over all records)
+//    40  record size
+//    44  reserved, 0
+//   records, in queue order, 'record size' bytes each
+//     0  priority (32-bit little-endian)
+//     4  reserved, 0
+//     8  element data, padded to a multiple of 8 bytes
+//
+// The header and priorities are portable.  The element data is stored
+// as raw bytes, so a file can only be loaded on a host with the byte
+// order that wrote it; this is checked.
+#define QUEUE_FILE_VERSION 1
+#define QUEUE_FILE_DUPLICATES 0x1
+#define QUEUE_FILE_TAG_ONLY 0x2
+
+// writes all elements of 'q' to 'fp' in the format above.  Returns
+// TRUE on success, otherwise FALSE.
+unsigned int save_queue(Queue *q, FILE *fp);
+
+// adds the elements of a queue file read from 'fp' to 'q', in the
+// order they were saved.  The element size of 'q' must match the
+// file.  Returns TRUE if the file is valid and all elements were
+// added, otherwise FALSE.  Nothing is added from a file that fails
+// validation, including the checksum.
+unsigned int load_queue(Queue *q, FILE *fp);
+
+// same as load_queue(), but maps the queue file 'filename' into memory
+// instead of reading it.  Each element is copied once, straight from
+// the mapping into its queue element; there is no intermediate
+// buffer.  (It is not strictly zero-copy: queue elements carry list
+// links, so they can't live in the mapped file itself.)
+unsigned int load_queue_mmap(Queue *q, const char *filename);
+
+
+// Delta snapshots.  track_queue_changes() gives every element of 'q'
+// a unique id and starts snapshot epoch 1.  From then on, elements
+// that are added, moved within the queue or updated through the queue
+// API are marked with the current epoch, and the ids of removed
+// elements are logged.  An element modified in place through a
+// pointer (pointer_to_current(), iterator_pointer(), ...) must be
+// marked with mark_handle_dirty().
+//
+// save_queue_snapshot() writes either every element (a full snapshot)
+// or only the changes of the current epoch (a delta), then starts the
+// next epoch.  A delta costs I/O in proportion to the changes, though
+// finding them still scans the queue once.  Snapshot files use the
+// same conventions as queue files (see save_queue()), with this
+// layout:
+//
+//   header (64 bytes, all fields little-endian)
+//     0  "PQSNAP\0\0"
+//     8  format version (QUEUE_SNAPSHOT_VERSION)
+//    12  byte order of element data (1 = little-endian, 2 = big-endian)
+//    16  element size
+//    20  flags (QUEUE_SNAPSHOT_FULL)
+//    24  base epoch (0 for a full snapshot)
+//    32  epoch
+//    40  # of removed ids
+//    48  # of element records
+//    56  checksum (64-bit FNV-1a over the rest of the file)
+//   removed ids, 8 bytes each
+//   element records, in queue order
+//     0  id (64 bits)
+//     8  id of the preceding element, 0 if first (64 bits)
+//    16  priority (32 bits)
+//    20  reserved, 0
+//    24  element data, padded to a multiple of 8 bytes
+//
+// Applying a delta removes the listed ids, then (re)inserts each
+// record after its predecessor.
+#define QUEUE_SNAPSHOT_VERSION 1
+#define QUEUE_SNAPSHOT_FULL 0x1
+
+// starts change tracking on 'q' (see above).  Every element is marked
+// as changed, so the first snapshot should be a full one.
+void track_queue_changes(Queue *q);
+
+// marks the element with handle 'h' in 'q' as changed in the current
+// epoch
+void mark_handle_dirty(Queue *q, Queue_element h);
+
+// writes a snapshot of 'q' to 'fp': every element if 'full' is TRUE,
+// otherwise the changes since the previous snapshot.  'q' must be
+// tracking changes.  Starts the next epoch.  Returns TRUE on success,
+// otherwise FALSE.
+unsigned int save_queue_snapshot(Queue *q, FILE *fp, unsigned int full);
+
+// applies the snapshot read from 'fp' to 'q'.  A full snapshot
+// replaces the contents of 'q'.  A delta must continue from the epoch
+// 'q' is at: the base epoch of the delta must be the epoch of the last
+// snapshot applied to (or saved from) 'q'.  Afterwards 'q' tracks
+// changes from the snapshot's epoch on.  Returns TRUE on success,
+// otherwise FALSE; nothing is changed if the snapshot fails
+// validation, including a delta that places an element after one that
+// isn't in 'q'.
+unsigned int apply_queue_snapshot(Queue *q, FILE *fp);
+
+// returns the element size recorded in the snapshot file 'fp', or 0 if
+// 'fp' doesn't start with a snapshot header.  The file position is
+// restored.
+unsigned int queue_snapshot_elementsize(FILE *fp);
+
+
 ////////////////////////////
 // SECTION 2
 ////////////////////////////
@@ -247,7 +787,8 @@ unsigned int deserialize_queue(Queue *q,
 // position. While these functions are thread-safe, obviously the
 // global position will be changed in potentially unpredictable ways
 // by overlapping access, so external synchronization is supported via
-// lock_queue() and unlock_queue() (see Section 3, below).
+// lock_queue() and unlock_queue() (see Section 3, below).  Iterator
+// objects (see Section 5, below) avoid the shared position entirely.
 
 // move to the first element in the 'q' 
 void rewind_queue (Queue *q);
@@ -277,6 +818,11 @@ void *pointer_to_current (Queue *q);
 int current_priority (Queue *q);
 
 
+// return a handle for the current element.  Returns NULL if the queue
+// is empty or there is no current element.
+Queue_element current_handle (Queue *q);
+
+
 // delete the element stored at the current position.
 void delete_current (Queue *q);
 
@@ -302,12 +848,32 @@ void lock_queue(Queue *q);
 // unlock the queue
 void unlock_queue(Queue *q);
 
+// lock all 'n' queues in 'queues' for a multi-queue transaction,
+// e.g. moving elements between queues with nolock_move_handle() so
+// that no other thread sees an element in neither or both queues.
+// The locks are taken in address order, so concurrent transactions on
+// overlapping sets of queues can't deadlock.  A queue may appear more
+// than once.  'queues' is not modified.
+void lock_queues(Queue *queues[], unsigned int n);
+
+// unlock all 'n' queues locked by lock_queues()
+void unlock_queues(Queue *queues[], unsigned int n);
+
 // thread-unsafe function versions (unless used with lock_queue() and unlock_queue()).
 void nolock_next_element(Queue *q);
 void nolock_rewind_queue(Queue *q);
 unsigned int nolock_element_in_queue(Queue *q, void *element);
 void nolock_destroy_queue(Queue *q);
 void nolock_add_to_queue(Queue *q, void *element, int priority);
+int nolock_try_add_to_queue(Queue *q, void *element, int priority);
+Queue_element nolock_add_to_queue_handle(Queue *q, void *element, int priority);
+void nolock_delete_handle(Queue *q, Queue_element h);
+Queue_element nolock_move_handle(Queue *to, Queue *from, Queue_element h, int priority);
+void nolock_rotate_queue(Queue *q);
+unsigned long nolock_add_many(Queue *q, void *elements, int *priorities, unsigned long n);
+unsigned long nolock_remove_up_to_n(Queue *q, void *elements, int *priorities, unsigned long n);
+unsigned long nolock_drain_into(Queue *to, Queue *from);
+Queue_element nolock_current_handle(Queue *q);
 void *nolock_pointer_to_current(Queue *q);
 int nolock_current_priority(Queue *q);
 unsigned int nolock_end_of_queue(Queue *q);
@@ -318,4 +884,485 @@ void *nolock_peek_at_current(Queue *q, void *element, int *priority);
 void nolock_delete_current(Queue *q);
 int nolock_delete_from_queue(Queue *q, void *element);
 void nolock_update_current(Queue *q, void *element);
+int nolock_update_front(Queue *q, Queue_updater fn, void *ctx);
+int nolock_update_handle(Queue *q, Queue_element h, Queue_updater fn, void *ctx);
+unsigned long nolock_update_matching(Queue *q, void *element, Queue_updater fn, void *ctx);
+
+
+////////////////////////////
+// SECTION 4
+////////////////////////////
+
+// Lock-free bounded multi-producer / multi-consumer FIFO queues.
+// These never take a mutex.  Each slot carries a sequence number, so
+// the only shared write per operation is one compare-and-swap on the
+// head or tail position.  All storage is allocated by
+// init_lf_queue() and released by destroy_lf_queue(), so no memory is
+// reclaimed while the queue is in use.  The priority is stored as a
+// tag only--LFQueues are always strict FIFO.  Other Queue functions
+// must not be called on an LFQueue.
+
+// initializes a new lock-free queue 'q' to hold at least 'capacity'
+// elements of size 'elementsize'.  'capacity' is rounded up to a
+// power of 2.
+void init_lf_queue(LFQueue *q, unsigned int elementsize, unsigned long capacity);
+
+// returns TRUE if init_lf_queue() has been called on 'q', otherwise
+// FALSE.
+int lf_queue_initialized(LFQueue *q);
+
+// releases all storage for 'q'.  No other thread may be using 'q'
+// when this is called.
+void destroy_lf_queue(LFQueue *q);
+
+// adds 'element' to the rear of 'q', tagged with 'priority'.  Returns
+// TRUE on success or FALSE if the queue is full.
+int lf_add_to_queue(LFQueue *q, void *element, int priority);
+
+// removes the element at the front of 'q' and places it in 'element'
+// and, if 'priority' is not NULL, its tag in 'priority'.  If the
+// queue is empty, returns NULL, otherwise a non-NULL value.
+void *lf_remove_from_front(LFQueue *q, void *element, int *priority);
+
+// returns the number of elements in 'q'.  With concurrent updates,
+// this is a snapshot that may already be stale.
+unsigned long lf_queue_length(LFQueue *q);
+
+// returns TRUE if 'q' is empty, FALSE otherwise.  Same caveat as
+// lf_queue_length().
+unsigned int lf_empty_queue(LFQueue *q);
+
+
+////////////////////////////
+// SECTION 5
+////////////////////////////
+
+// Iterator objects.  Each Queue_iterator has its own position, so any
+// number of iterators can walk the same queue without disturbing each
+// other or the queue's global current position (Section 2).
+//
+// A live iterator walks the queue itself.  Each call briefly locks
+// the queue, as the Section 2 functions do.  The caller must make sure
+// the element under the iterator isn't deleted by someone else while
+// it is in use.  Use iterator_delete() to delete that element through
+// the iterator.
+//
+// A snapshot iterator copies every element and priority under a
+// single acquisition of the queue lock when it is initialized.  It
+// never touches the queue again, so any number of threads can scan
+// concurrently with updates.  Changes made after the snapshot are not
+// visible, and iterator_handle() and iterator_delete() are not
+// available.
+
+// initializes iterator 'it' on queue 'q', positioned at the first
+// element.  If 'snapshot' is TRUE, a snapshot iterator is created,
+// otherwise a live iterator.
+void init_iterator(Queue *q, Queue_iterator *it, unsigned int snapshot);
+
+// releases storage held by 'it'.  Required for snapshot iterators,
+// harmless for live ones.
+void destroy_iterator(Queue_iterator *it);
+
+// move 'it' back to the first element.  Snapshot iterators rewind to
+// the first element of the original snapshot.
+void iterator_rewind(Queue_iterator *it);
+
+// move 'it' to the next element.
+void iterator_next(Queue_iterator *it);
+
+// has 'it' moved beyond the last element?  Returns TRUE if so, FALSE
+// otherwise.
+unsigned int iterator_end(Queue_iterator *it);
+
+// return a pointer to the element under 'it', or NULL at the end.
+void *iterator_pointer(Queue_iterator *it);
+
+// return the priority of the element under 'it'.
+int iterator_priority(Queue_iterator *it);
+
+// return a handle for the element under live iterator 'it', or NULL
+// at the end.
+Queue_element iterator_handle(Queue_iterator *it);
+
+// delete the element under live iterator 'it' and advance 'it' to the
+// following element.
+void iterator_delete(Queue_iterator *it);
+
+
+////////////////////////////
+// SECTION 6
+////////////////////////////
+
+// Sharded FIFO queues.  A ShardedQueue holds 'nshards' ordinary
+// Queues, each on its own cache lines.  Each thread has an affinity
+// for one shard: it adds to that shard and starts removing from it.
+// Producers on different threads therefore rarely contend for the
+// same lock.
+//
+// By default, elements are removed in global FIFO order.  Every
+// element is stamped with a ticket from a single atomic counter, and
+// removal takes the oldest shard head.  That costs one atomic
+// increment per add and a scan of the shard heads per remove.  With
+// 'relaxed_order' set, the ticket is skipped.  Elements added by a
+// single thread still come out in the order that thread added them,
+// but elements from different threads may be reordered.  A consumer
+// then drains its own shard first and steals round-robin from the
+// others when its own is empty.  Priorities are stored as tags only.
+
+// initializes 'sq' to hold elements of size 'elementsize' spread over
+// 'nshards' sub-queues (at least 1).  If 'relaxed_order' is TRUE, only
+// per-producer FIFO order is guaranteed.
+void init_sharded_queue(ShardedQueue *sq, unsigned int elementsize,
+			unsigned int nshards, unsigned int relaxed_order);
+
+// destroys all elements in 'sq' and releases its storage.
+void destroy_sharded_queue(ShardedQueue *sq);
+
+// adds 'element' to the calling thread's shard of 'sq', tagged with
+// 'priority'.
+void sharded_add_to_queue(ShardedQueue *sq, void *element, int priority);
+
+// removes the oldest element of 'sq' (or, with relaxed ordering, an
+// element from the calling thread's shard or a shard it steals from)
+// and places it in 'element' and, if 'priority' is not NULL, its tag
+// in 'priority'.  If the queue is empty, returns NULL, otherwise a
+// non-NULL value.
+void *sharded_remove_from_front(ShardedQueue *sq, void *element, int *priority);
+
+// returns the number of elements in 'sq', summed over its shards
+// without locking.
+unsigned long sharded_queue_length(ShardedQueue *sq);
+
+// returns TRUE if 'sq' is empty, FALSE otherwise.
+unsigned int sharded_empty_queue(ShardedQueue *sq);
+
+
+////////////////////////////
+// SECTION 7
+////////////////////////////
+
+// Allocator hooks and arenas.  By default, queue elements come from
+// malloc() and are returned with free().  A queue can instead use a
+// caller-supplied Queue_allocator or a Queue_arena.  Only element
+// storage goes through the allocator; the hash index of a hashed
+// queue and iterator snapshots still use malloc().
+//
+// If the allocator has no 'release' callback (arenas don't), deleted
+// elements are kept on a per-queue free list and reused by later
+// adds.  destroy_queue() on such a queue simply drops its elements in
+// O(1); their memory is released with the arena (or by whatever owns
+// the allocator).
+//
+// move_handle() and drain_into() relink elements in place only between
+// queues with the same allocator (same callbacks and 'ctx', so queues
+// on the same arena qualify).  Otherwise each element is copied into
+// storage from the destination's allocator, and the original is
+// released, so handles returned by move_handle() may change.
+
+// same as init_queue(), but elements of 'q' are allocated with
+// '*allocator', which is copied into the queue.
+void init_queue_with_allocator(Queue *q, unsigned int elementsize, unsigned int duplicates,
+			       int (*compare) (const void *e1, const void *e2),
+			       unsigned int priority_is_tag_only,
+			       Queue_allocator *allocator);
+
+// same as init_queue(), but elements of 'q' are allocated from
+// 'arena'.  Several queues may share an arena.  The arena must outlive
+// every queue that uses it.
+void init_queue_with_arena(Queue *q, unsigned int elementsize, unsigned int duplicates,
+			   int (*compare) (const void *e1, const void *e2),
+			   unsigned int priority_is_tag_only,
+			   Queue_arena *arena);
+
+// initializes 'arena' to hand out memory in chunks of (at least)
+// 'chunksize' bytes.  If 'huge_pages' is TRUE, chunks are rounded up
+// to a multiple of 2MB and mapped with explicit huge pages where the
+// system has them reserved, falling back to transparent huge pages.
+void init_queue_arena(Queue_arena *arena, size_t chunksize, unsigned int huge_pages);
+
+// returns all memory handed out by 'arena' to it, keeping its newest
+// chunk for reuse.  Every queue using the arena must be destroyed (or
+// no longer used) first.
+void reset_queue_arena(Queue_arena *arena);
+
+// releases all memory of 'arena'.  Every queue using the arena must be
+// destroyed (or no longer used) first.
+void destroy_queue_arena(Queue_arena *arena);
+
+
+////////////////////////////
+// SECTION 8
+////////////////////////////
+
+// Typed queues.  DEFINE_PRIOQUE(T, cmp) defines static inline
+// functions for Queues whose elements have type 'T', a type name that
+// is a single identifier (use a typedef for structs).  'cmp' has the
+// signature
+//
+//   int cmp(const T *e1, const T *e2)
+//
+// with the same meaning as the 'compare' function of init_queue().  It
+// is called directly, so it can be inlined.  The generated functions
+// match their generic namesakes, except that elements are 'T *'
+// rather than 'void *':
+//
+//   void         T_init_queue(Queue *q, unsigned int duplicates,
+//                             unsigned int priority_is_tag_only);
+//   void         T_add_to_queue(Queue *q, const T *element, int priority);
+//   Queue_element T_add_to_queue_handle(Queue *q, const T *element, int priority);
+//   T           *T_remove_from_front(Queue *q, T *element);
+//   T           *T_peek_at_current(Queue *q, T *element, int *priority);
+//   T           *T_pointer_to_current(Queue *q);
+//   T           *T_pointer_to_handle(Queue_element h);
+//   unsigned int T_element_in_queue(Queue *q, const T *element);
+//   int          T_delete_from_queue(Queue *q, const T *element);
+//
+// Each one except T_init_queue() and T_pointer_to_handle() has a
+// T_nolock_ twin (e.g. T_nolock_add_to_queue()) for use under
+// lock_queue().  T_init_queue() installs a 'compare' wrapper around
+// 'cmp', so generic functions on the queue agree with the typed ones.
+// A typed queue can also be initialized with any other init_queue
+// variant, as long as its element size is sizeof(T).
+//
+// The functions below are the building blocks of the typed
+// operations.  They are not normally called directly.  All of them
+// require the queue to be locked (or otherwise private to the caller).
+
+// returns a new, unlinked element for 'q' with the given priority.
+// Its data (at 'info') is uninitialized.
+Queue_element nolock_new_element(Queue *q, int priority);
+
+// links element 'e' from nolock_new_element() into 'q' in priority
+// order.  The caller has already dealt with duplicates.
+void nolock_link_new_element(Queue *q, Queue_element e);
+
+// unlinks the front element of 'q' and returns it, or returns NULL if
+// 'q' is empty.  The element must be released with
+// nolock_free_element().
+Queue_element nolock_unlink_front(Queue *q);
+
+// releases an element of 'q' that is no longer linked.
+void nolock_free_element(Queue *q, Queue_element e);
+
+// aborts the program with a message naming 'fn' if 'q' isn't
+// initialized
+#define PRIOQUE_CHECK_QUEUE(q, fn)					\
+  do {									\
+    if ((q)->magic != QUEUE_MAGIC) {					\
+      fprintf(stderr, "** QUEUE NOT INITIALIZED in prioque.h %s() **\n", fn); \
+      exit(1);								\
+    }									\
+  } while (0)
+
+#define DEFINE_PRIOQUE(T, cmp)						\
+									\
+static inline int T##_queue_compare(const void *e1, const void *e2) {	\
+  return cmp((const T *) e1, (const T *) e2);				\
+}									\
+									\
+static inline void T##_init_queue(Queue *q, unsigned int duplicates,	\
+				  unsigned int priority_is_tag_only) {	\
+  init_queue(q, sizeof(T), duplicates, T##_queue_compare, priority_is_tag_only); \
+}									\
+									\
+static inline Queue_element T##_nolock_find(Queue *q, const T *element) { \
+  Queue_element ptr;							\
+  for (ptr = q->queue; ptr != NULL; ptr = ptr->next) {			\
+    PRIOQUE_STAT(q, scan_steps);					\
+    PRIOQUE_STAT(q, compares);						\
+    if (cmp(element, (const T *) ptr->info) == 0) {			\
+      return ptr;							\
+    }									\
+  }									\
+  return NULL;								\
+}									\
+									\
+static inline unsigned int T##_nolock_element_in_queue(Queue *q, const T *element) { \
+  Queue_element match;							\
+  PRIOQUE_CHECK_QUEUE(q, #T "_nolock_element_in_queue");		\
+  if (q->hash) {							\
+    return nolock_element_in_queue(q, (void *) element);		\
+  }									\
+  /* the match becomes current, as in nolock_element_in_queue() */	\
+  if ((match = T##_nolock_find(q, element)) != NULL) {			\
+    q->current = match;							\
+    q->previous = match->prev;						\
+  }									\
+  else {								\
+    nolock_rewind_queue(q);						\
+  }									\
+  return match != NULL;							\
+}									\
+									\
+static inline unsigned int T##_element_in_queue(Queue *q, const T *element) { \
+  unsigned int ret;							\
+  PRIOQUE_CHECK_QUEUE(q, #T "_element_in_queue");			\
+  PRIOQUE_LOCK(q);							\
+  ret = T##_nolock_element_in_queue(q, element);			\
+  pthread_mutex_unlock(&(q->lock));					\
+  return ret;								\
+}									\
+									\
+static inline Queue_element T##_nolock_add_to_queue_handle(Queue *q, const T *element, \
+							   int priority) { \
+  Queue_element e;							\
+  PRIOQUE_CHECK_QUEUE(q, #T "_nolock_add_to_queue_handle");		\
+  if (! q->duplicates && q->queue && T##_nolock_element_in_queue(q, element)) { \
+    /* duplicates are silently deleted */				\
+    return NULL;							\
+  }									\
+  e = nolock_new_element(q, priority);					\
+  *(T *) e->info = *element;						\
+  nolock_link_new_element(q, e);					\
+  return e;								\
+}									\
+									\
+static inline Queue_element T##_add_to_queue_handle(Queue *q, const T *element, int priority) { \
+  Queue_element h;							\
+  PRIOQUE_CHECK_QUEUE(q, #T "_add_to_queue_handle");			\
+  PRIOQUE_LOCK(q);							\
+  h = T##_nolock_add_to_queue_handle(q, element, priority);		\
+  pthread_mutex_unlock(&(q->lock));					\
+  return h;								\
+}									\
+									\
+static inline void T##_nolock_add_to_queue(Queue *q, const T *element, int priority) { \
+  T##_nolock_add_to_queue_handle(q, element, priority);			\
+}									\
+									\
+static inline void T##_add_to_queue(Queue *q, const T *element, int priority) { \
+  T##_add_to_queue_handle(q, element, priority);			\
+}									\
+									\
+static inline T *T##_nolock_remove_from_front(Queue *q, T *element) {	\
+  Queue_element e;							\
+  PRIOQUE_CHECK_QUEUE(q, #T "_nolock_remove_from_front");		\
+  e = nolock_unlink_front(q);						\
+  if (e == NULL) {							\
+    return NULL;							\
+  }									\
+  *element = *(T *) e->info;						\
+  nolock_free_element(q, e);						\
+  return element;							\
+}									\
+									\
+static inline T *T##_remove_from_front(Queue *q, T *element) {		\
+  T *ret;								\
+  PRIOQUE_CHECK_QUEUE(q, #T "_remove_from_front");			\
+  PRIOQUE_LOCK(q);							\
+  ret = T##_nolock_remove_from_front(q, element);			\
+  pthread_mutex_unlock(&(q->lock));					\
+  return ret;								\
+}									\
+									\
+static inline T *T##_nolock_peek_at_current(Queue *q, T *element, int *priority) { \
+  PRIOQUE_CHECK_QUEUE(q, #T "_nolock_peek_at_current");		\
+  if (q->current == NULL) {						\
+    return NULL;							\
+  }									\
+  *element = *(T *) q->current->info;					\
+  if (priority) {							\
+    *priority = q->current->priority;					\
+  }									\
+  return element;							\
+}									\
+									\
+static inline T *T##_peek_at_current(Queue *q, T *element, int *priority) { \
+  T *ret;								\
+  PRIOQUE_CHECK_QUEUE(q, #T "_peek_at_current");			\
+  PRIOQUE_LOCK(q);							\
+  ret = T##_nolock_peek_at_current(q, element, priority);		\
+  pthread_mutex_unlock(&(q->lock));					\
+  return ret;								\
+}									\
+									\
+static inline T *T##_nolock_pointer_to_current(Queue *q) {		\
+  PRIOQUE_CHECK_QUEUE(q, #T "_nolock_pointer_to_current");		\
+  return q->current ? (T *) q->current->info : NULL;			\
+}									\
+									\
+static inline T *T##_pointer_to_current(Queue *q) {			\
+  T *ret;								\
+  PRIOQUE_CHECK_QUEUE(q, #T "_pointer_to_current");			\
+  PRIOQUE_LOCK(q);							\
+  ret = T##_nolock_pointer_to_current(q);				\
+  pthread_mutex_unlock(&(q->lock));					\
+  return ret;								\
+}									\
+									\
+static inline T *T##_pointer_to_handle(Queue_element h) {		\
+  return (T *) pointer_to_handle(h);					\
+}									\
+									\
+static inline int T##_nolock_delete_from_queue(Queue *q, const T *element) { \
+  PRIOQUE_CHECK_QUEUE(q, #T "_nolock_delete_from_queue");		\
+  /* as in nolock_delete_from_queue(), the successor becomes current */ \
+  if (! T##_nolock_element_in_queue(q, element)) {			\
+    return FALSE;							\
+  }									\
+  nolock_delete_current(q);						\
+  return TRUE;								\
+}									\
+									\
+static inline int T##_delete_from_queue(Queue *q, const T *element) {	\
+  int ret;								\
+  PRIOQUE_CHECK_QUEUE(q, #T "_delete_from_queue");			\
+  PRIOQUE_LOCK(q);							\
+  ret = T##_nolock_delete_from_queue(q, element);			\
+  pthread_mutex_unlock(&(q->lock));					\
+  return ret;								\
+}
+
+
+////////////////////////////
+// SECTION 9
+////////////////////////////
+
+// Instrumentation.  If PRIOQUE_STATS is defined, every queue keeps a
+// Queue_stats with counts of the work done on it, to show whether time
+// goes into list walks, locking or allocation.  The counters are
+// plain fields updated with the queue locked (or by the nolock_
+// functions, under the caller's lock), so they cost an increment each.
+// PRIOQUE_STATS changes the layout of Queue, so prioque.c and all of
+// its callers must be compiled with the same setting.
+//
+// Without PRIOQUE_STATS, the counters don't exist and the increments
+// and counted lock acquisitions compile to nothing.  The functions
+// below remain available so that callers need no conditionals:
+// queue_stats() reports all zeros and the rest do nothing.
+
+#if defined(PRIOQUE_STATS)
+#define PRIOQUE_STAT(q, field) ((q)->stats.field++)
+#define PRIOQUE_LOCK(q) prioque_lock_counted(q)
+
+// acquires the lock on 'q', counting the acquisition and whether it
+// had to wait
+static inline void prioque_lock_counted(Queue *q) {
+  if (pthread_mutex_trylock(&(q->lock)) != 0) {
+    pthread_mutex_lock(&(q->lock));
+    q->stats.contended++;
+  }
+  q->stats.locks++;
+}
+#else
+#define PRIOQUE_STAT(q, field) ((void) 0)
+#define PRIOQUE_LOCK(q) pthread_mutex_lock(&((q)->lock))
+#endif
+
+// copies the counters of 'q' into '*stats'.
+void queue_stats(Queue *q, Queue_stats *stats);
+
+// zeroes the counters of 'q'.  The peak length restarts at the
+// current length.
+void reset_queue_stats(Queue *q);
+
+// registers 'q' under 'name' for the report printed to stderr at
+// program exit.  If 'q' is destroyed first, the report shows its
+// counters as of destroy_queue().  'name' must remain valid until
+// exit.
+void report_queue_stats(Queue *q, const char *name);
+
+// prints the counters of every queue registered with
+// report_queue_stats() to 'fp', one line per queue.
+void dump_queue_stats(FILE *fp);
 #endif
@@ -0,0 +1,64 @@
+//
+// Illustrates basic usage of the histogram.c functions.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "histogram.h"
+
+int main(int argc, char *argv[]) {
+
+  static Histogram h, h2;
+  unsigned long i, v;
+
+  printf("TESTING HISTOGRAM FUNCTIONALITY.\n");
+  printf("--------------------------------\n");
+
+  printf("\n");
+
+  printf("Recording the values 1..1000.\n");
+  hist_init(&h);
+  for (i=1; i <= 1000; i++) {
+    hist_record(&h, i);
+  }
+  printf("count %lu min %lu max %lu mean %.1f\n", h.total, h.min, h.max, hist_mean(&h));
+  printf("p50 %lu (exact 500), p90 %lu (exact 900), p99 %lu (exact 990), p100 %lu\n",
+	 hist_percentile(&h, 50.0), hist_percentile(&h, 90.0), hist_percentile(&h, 99.0),
+	 hist_percentile(&h, 100.0));
+
+  printf("Checking the relative error of every percentile up to 10^6.\n");
+  hist_init(&h2);
+  for (i=0; i < 1000000; i++) {
+    hist_record(&h2, i);
+  }
+  v = 0;
+  for (i=1; i <= 100; i++) {
+    unsigned long p = hist_percentile(&h2, (double) i);
+    unsigned long exact = i * 10000 - 1;
+    unsigned long err = p > exact ? p - exact : exact - p;
+    if (err * HIST_SUB_BUCKETS > exact) {
+      printf("p%lu is %lu, too far from %lu\n", i, p, exact);
+      v++;
+    }
+  }
+  printf("%lu percentiles out of tolerance.\n", v);
+
+  printf("Recording values near the extremes of unsigned long.\n");
+  hist_init(&h2);
+  hist_record(&h2, 0);
+  hist_record(&h2, ~0UL);
+  printf("p50 %lu, p100 %s ULONG_MAX.\n", hist_percentile(&h2, 50.0),
+	 hist_percentile(&h2, 100.0) == ~0UL ? "is" : "is NOT");
+
+  printf("Merging 1..1000 into the extremes.\n");
+  hist_merge(&h2, &h);
+  printf("count %lu min %lu\n", h2.total, h2.min);
+
+  printf("Distribution of 1..1000:\n");
+  hist_print(stdout, &h, 40);
+  hist_summary(stdout, "1..1000", &h);
+
+  printf("\n");
+
+  return 0;
+}
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
 #include "prioque.h"
 
 typedef struct _SomeType {
@@ -29,6 +30,241 @@ int some_type_compare(const void *e1, const void *e2) {
 }
 
 
+// comparison and hash functions for hashed queues of ints
+int int_compare(const void *e1, const void *e2) {
+  return *(const int *)e1 != *(const int *)e2;
+}
+
+unsigned long int_hash(const void *e) {
+  return (unsigned long)(*(const int *)e) * 0x9E3779B97F4A7C15UL;
+}
+
+
+#define LF_PRODUCERS 4
+#define LF_CONSUMERS 4
+#define LF_PER_PRODUCER 100000
+
+// shared state for the lock-free queue test
+LFQueue lfq;
+atomic_ulong lf_consumed;
+atomic_ulong lf_sum;
+atomic_uint lf_order_errors;
+
+// adds LF_PER_PRODUCER tagged elements to 'lfq', retrying when full
+void *lf_producer(void *arg) {
+  long id=(long)arg;
+  long i, e;
+  for (i=0; i < LF_PER_PRODUCER; i++) {
+    e=id * LF_PER_PRODUCER + i;
+    while (! lf_add_to_queue(&lfq, &e, (int)id)) {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+// removes elements until every produced element has been consumed,
+// checking that each producer's elements arrive in FIFO order
+void *lf_consumer(void *arg) {
+  long last[LF_PRODUCERS];
+  long e;
+  int id, i;
+  (void) arg;
+  for (i=0; i < LF_PRODUCERS; i++) {
+    last[i]=-1;
+  }
+  while (atomic_load(&lf_consumed) < LF_PRODUCERS * LF_PER_PRODUCER) {
+    if (lf_remove_from_front(&lfq, &e, &id)) {
+      if (e <= last[id]) {
+	atomic_fetch_add(&lf_order_errors, 1);
+      }
+      last[id]=e;
+      atomic_fetch_add(&lf_sum, e);
+      atomic_fetch_add(&lf_consumed, 1);
+    }
+    else {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+
+#define MOVERS 4
+#define MOVES_PER_THREAD 20000
+
+// shared state for the multi-queue transaction test
+Queue left_q, right_q;
+
+// repeatedly moves the front element between left_q and right_q in a
+// transaction.  Even threads move left to right, odd threads right to
+// left, and each lists its queues in its own direction's order.
+void *mover(void *arg) {
+  long id=(long)arg;
+  Queue *from=(id % 2) ? &right_q : &left_q;
+  Queue *to=(id % 2) ? &left_q : &right_q;
+  Queue *queues[2];
+  Queue_element h;
+  int i;
+
+  queues[0]=from;
+  queues[1]=to;
+  for (i=0; i < MOVES_PER_THREAD; i++) {
+    lock_queues(queues, 2);
+    nolock_rewind_queue(from);
+    h=nolock_current_handle(from);
+    if (h) {
+      nolock_move_handle(to, from, h, 0);
+    }
+    unlock_queues(queues, 2);
+    if (i % 1000 == 0) {
+      drain_into(to, from);
+    }
+  }
+  return NULL;
+}
+
+
+#define WORK_ITEMS 10000
+
+// shared state for the blocking work queue test
+Queue work_q;
+atomic_ulong work_done;
+
+// adds WORK_ITEMS elements to work_q, then closes it
+void *work_producer(void *arg) {
+  long i;
+  (void) arg;
+  for (i=0; i < WORK_ITEMS; i++) {
+    add_to_queue(&work_q, &i, 0);
+  }
+  close_queue(&work_q);
+  return NULL;
+}
+
+// consumes from work_q until the queue is closed and empty
+void *work_consumer(void *arg) {
+  long e;
+  (void) arg;
+  while (remove_from_front_wait(&work_q, &e, -1)) {
+    atomic_fetch_add(&work_done, 1);
+  }
+  return NULL;
+}
+
+
+// shared by the sharded queue tests
+ShardedQueue shq;
+#define SHARD_PRODUCERS 4
+#define SHARD_ITEMS 10000
+
+// adds SHARD_ITEMS increasing values, tagged with the producer's number
+void *shard_producer(void *arg) {
+  long i, id = (long)arg;
+
+  for (i=0; i < SHARD_ITEMS; i++) {
+    sharded_add_to_queue(&shq, &i, (int)id);
+  }
+  return NULL;
+}
+
+// counts live elements of a queue using counting_allocator
+unsigned long live_elements = 0;
+
+void *counting_alloc(size_t size, void *ctx) {
+  (void) ctx;
+  live_elements++;
+  return malloc(size);
+}
+
+void counting_release(void *ptr, void *ctx) {
+  (void) ctx;
+  live_elements--;
+  free(ptr);
+}
+
+// element type for the typed queue tests
+typedef struct Job {
+  int id;
+  double cost;
+} Job;
+
+int job_compare(const Job *j1, const Job *j2) {
+  return j1->id != j2->id;
+}
+
+DEFINE_PRIOQUE(Job, job_compare)
+
+// shared state for the bounded queue test
+Queue bounded_q;
+#define BOUNDED_CAPACITY 8
+#define BOUNDED_ITEMS 1000
+unsigned long high_crossings = 0, low_crossings = 0, max_bounded_length = 0;
+
+// counts watermark crossings; runs with bounded_q locked
+void bounded_watermark(Queue *q, unsigned int high, void *ctx) {
+  (void) q;
+  (void) ctx;
+  if (high) {
+    high_crossings++;
+  }
+  else {
+    low_crossings++;
+  }
+}
+
+// adds BOUNDED_ITEMS elements to bounded_q, waiting while it is full
+void *bounded_producer(void *arg) {
+  long i;
+  (void) arg;
+  for (i=0; i < BOUNDED_ITEMS; i++) {
+    add_to_queue_wait(&bounded_q, &i, 0, -1);
+    if (queue_length(&bounded_q) > max_bounded_length) {
+      max_bounded_length = queue_length(&bounded_q);
+    }
+  }
+  close_queue(&bounded_q);
+  return NULL;
+}
+
+// sends every element it sees to the rear of the queue
+Queue_action requeue_element(void *element, int *priority, void *ctx) {
+  (void) element;
+  (void) priority;
+  (void) ctx;
+  return QUEUE_REQUEUE;
+}
+
+// element type for the update callback tests
+typedef struct Slice {
+  int id;
+  int quantum;
+} Slice;
+
+int slice_compare(const void *e1, const void *e2) {
+  return ((Slice *)e1)->id != ((Slice *)e2)->id;
+}
+
+// uses up one tick of quantum; a slice with no quantum left is
+// removed, one with quantum left goes to the rear
+Queue_action run_slice(void *element, int *priority, void *ctx) {
+  Slice *s = (Slice *)element;
+  (void) priority;
+  if (--(s->quantum) == 0) {
+    (*(int *)ctx)++;
+    return QUEUE_REMOVE;
+  }
+  return QUEUE_REQUEUE;
+}
+
+// raises the priority of an element by 10
+Queue_action boost_slice(void *element, int *priority, void *ctx) {
+  (void) element;
+  (void) ctx;
+  *priority += 10;
+  return QUEUE_KEEP;
+}
+
 int main(int argc, char *argv[]) {
   Queue q, another_q;
   SomeType s1, s2, s3, s4, e;
@@ -272,5 +508,917 @@ int main(int argc, char *argv[]) {
   printf("\n");
 
   // ------------------- END OF TESTING QUEUE FUNCTIONS ---------------------
-}
 
+  // ----------------- START OF LOCK-FREE QUEUE TESTING ---------------------
+
+  printf("TESTING LOCK-FREE QUEUE FUNCTIONALITY.\n");
+  printf("--------------------------------------\n");
+
+  printf("\n");
+
+  {
+    pthread_t producers[LF_PRODUCERS], consumers[LF_CONSUMERS];
+    unsigned long expected=0, n=(unsigned long)LF_PRODUCERS * LF_PER_PRODUCER;
+    long i, e;
+    int tag;
+
+    printf("Initializing lock-free queue with capacity 1000.\n");
+    init_lf_queue(&lfq, sizeof(long), 1000);
+    printf("Capacity rounded up to %lu.\n", lfq.capacity);
+
+    printf("Filling queue until it reports full.\n");
+    for (i=0; lf_add_to_queue(&lfq, &i, 0); i++)
+      ;
+    printf("Queue accepted %ld elements, length is %lu.\n", i, lf_queue_length(&lfq));
+    while (lf_remove_from_front(&lfq, &e, &tag))
+      ;
+    printf("Queue drained, empty is %s.\n", lf_empty_queue(&lfq) ? "TRUE" : "FALSE");
+
+    printf("Running %d producers and %d consumers.\n", LF_PRODUCERS, LF_CONSUMERS);
+    atomic_init(&lf_consumed, 0);
+    atomic_init(&lf_sum, 0);
+    atomic_init(&lf_order_errors, 0);
+    for (i=0; i < LF_CONSUMERS; i++) {
+      pthread_create(&consumers[i], NULL, lf_consumer, NULL);
+    }
+    for (i=0; i < LF_PRODUCERS; i++) {
+      pthread_create(&producers[i], NULL, lf_producer, (void *)i);
+    }
+    for (i=0; i < LF_PRODUCERS; i++) {
+      pthread_join(producers[i], NULL);
+    }
+    for (i=0; i < LF_CONSUMERS; i++) {
+      pthread_join(consumers[i], NULL);
+    }
+
+    expected=n * (n - 1) / 2;
+    if (atomic_load(&lf_consumed) == n && atomic_load(&lf_sum) == expected &&
+	atomic_load(&lf_order_errors) == 0) {
+      printf("All %lu elements consumed exactly once in per-producer FIFO order.\n", n);
+    }
+    else {
+      printf("Something went wrong!  Consumed %lu, sum %lu (expected %lu), %u order errors.\n",
+	     atomic_load(&lf_consumed), atomic_load(&lf_sum), expected,
+	     atomic_load(&lf_order_errors));
+    }
+
+    destroy_lf_queue(&lfq);
+  }
+
+  printf("\n");
+
+  // ------------------ END OF LOCK-FREE QUEUE TESTING ----------------------
+
+  // ------------------- START OF HASHED QUEUE TESTING ----------------------
+
+  printf("TESTING HASHED QUEUE FUNCTIONALITY.\n");
+  printf("-----------------------------------\n");
+
+  printf("\n");
+
+  {
+    Queue hq, lq;
+    int i, found=0;
+
+    printf("Initializing hashed and unhashed unique-element queues.\n");
+    init_queue_hashed(&hq, sizeof(int), FALSE, int_compare, int_hash, TRUE);
+    init_queue(&lq, sizeof(int), FALSE, int_compare, TRUE);
+
+    printf("Adding 0..4999 twice to each queue.\n");
+    for (i=0; i < 10000; i++) {
+      int v=i % 5000;
+      add_to_queue(&hq, &v, 0);
+      add_to_queue(&lq, &v, 0);
+    }
+    printf("Hashed queue length is %lu, unhashed queue length is %lu.\n",
+	   queue_length(&hq), queue_length(&lq));
+
+    printf("Deleting all even elements from both queues.\n");
+    for (i=0; i < 5000; i += 2) {
+      delete_from_queue(&hq, &i);
+      delete_from_queue(&lq, &i);
+    }
+    for (i=0; i < 5000; i++) {
+      found += element_in_queue(&hq, &i);
+    }
+    printf("Hashed queue length is %lu, %d elements found by lookup.\n",
+	   queue_length(&hq), found);
+
+    if (equal_queues(&hq, &lq)) {
+      printf("Queues are equal.\n");
+    }
+    else {
+      printf("Something went wrong!  Queues aren't equal.\n");
+    }
+
+    i=4999;
+    element_in_queue(&hq, &i);
+    printf("After lookup of %d, current element is %d.\n", i, *(int *)pointer_to_current(&hq));
+
+    i=7777;
+    update_current(&hq, &i);
+    printf("Changed 4999 to 7777 in place.  Lookup of 4999 %s, lookup of 7777 %s.\n",
+	   element_in_queue(&hq, &(int){4999}) ? "SUCCEEDS" : "fails",
+	   element_in_queue(&hq, &i) ? "succeeds" : "FAILS");
+
+    destroy_queue(&hq);
+    destroy_queue(&lq);
+  }
+
+  printf("\n");
+
+  // -------------------- END OF HASHED QUEUE TESTING -----------------------
+
+  // ------------------- START OF ELEMENT HANDLE TESTING --------------------
+
+  printf("TESTING ELEMENT HANDLE FUNCTIONALITY.\n");
+  printf("-------------------------------------\n");
+
+  printf("\n");
+
+  {
+    Queue_element h1, h3;
+
+    printf("Initializing FIFO queues q and another_q.\n");
+    init_queue(&q, sizeof(SomeType), TRUE, some_type_compare, TRUE);
+    init_queue(&another_q, sizeof(SomeType), TRUE, some_type_compare, TRUE);
+
+    printf("Adding %d / %s, %d / %s, %d / %s and %d / %s to queue q.\n",
+	   s1.a, s1.buf, s2.a, s2.buf, s3.a, s3.buf, s4.a, s4.buf);
+    h1=add_to_queue_handle(&q, &s1, s1.a);
+    add_to_queue_handle(&q, &s2, s2.a);
+    h3=add_to_queue_handle(&q, &s3, s3.a);
+    add_to_queue_handle(&q, &s4, s4.a);
+
+    printf("Rotating queue q twice.\n");
+    rotate_queue(&q);
+    rotate_queue(&q);
+
+    printf("Moving %d / %s to another_q and deleting %d / %s by handle.\n",
+	   ((SomeType *)pointer_to_handle(h1))->a, ((SomeType *)pointer_to_handle(h1))->buf,
+	   ((SomeType *)pointer_to_handle(h3))->a, ((SomeType *)pointer_to_handle(h3))->buf);
+    move_handle(&another_q, &q, h1, s1.a);
+    delete_handle(&q, h3);
+
+    printf("\n");
+
+    element=0;
+    rewind_queue(&q);
+    printf("Queue q contains:\n");
+    while (! end_of_queue(&q)) {
+      printf("%d --> %d / %s with tag %d.\n",
+	     ++element,
+	     ((SomeType *)pointer_to_current(&q))->a,
+	     ((SomeType *)pointer_to_current(&q))->buf,
+	     current_priority(&q));
+      next_element(&q);
+    }
+
+    element=0;
+    rewind_queue(&another_q);
+    printf("Queue another_q contains:\n");
+    while (! end_of_queue(&another_q)) {
+      printf("%d --> %d / %s with tag %d.\n",
+	     ++element,
+	     ((SomeType *)pointer_to_current(&another_q))->a,
+	     ((SomeType *)pointer_to_current(&another_q))->buf,
+	     current_priority(&another_q));
+      next_element(&another_q);
+    }
+
+    printf("Moved handle now refers to %d / %s.\n",
+	   ((SomeType *)pointer_to_handle(h1))->a, ((SomeType *)pointer_to_handle(h1))->buf);
+
+    destroy_queue(&q);
+    destroy_queue(&another_q);
+  }
+
+  printf("\n");
+
+  // -------------------- END OF ELEMENT HANDLE TESTING ---------------------
+
+  // ---------------------- START OF ITERATOR TESTING -----------------------
+
+  printf("TESTING ITERATOR FUNCTIONALITY.\n");
+  printf("-------------------------------\n");
+
+  printf("\n");
+
+  {
+    Queue_iterator outer, inner, snap;
+    int pairs=0;
+
+    printf("Initializing priority queue q.\n");
+    init_queue(&q, sizeof(SomeType), TRUE, some_type_compare, FALSE);
+    add_to_queue(&q, &s1, s1.a);
+    add_to_queue(&q, &s2, s2.a);
+    add_to_queue(&q, &s3, s3.a);
+    add_to_queue(&q, &s4, s4.a);
+
+    printf("Counting ordered pairs with two nested live iterators.\n");
+    init_iterator(&q, &outer, FALSE);
+    while (! iterator_end(&outer)) {
+      init_iterator(&q, &inner, FALSE);
+      while (! iterator_end(&inner)) {
+	pairs++;
+	iterator_next(&inner);
+      }
+      destroy_iterator(&inner);
+      iterator_next(&outer);
+    }
+    destroy_iterator(&outer);
+    printf("Found %d pairs.\n", pairs);
+
+    printf("Taking a snapshot, then deleting elements with priority 5 through a live iterator.\n");
+    init_iterator(&q, &snap, TRUE);
+    init_iterator(&q, &outer, FALSE);
+    while (! iterator_end(&outer)) {
+      if (iterator_priority(&outer) == 5) {
+	iterator_delete(&outer);
+      }
+      else {
+	iterator_next(&outer);
+      }
+    }
+    destroy_iterator(&outer);
+
+    printf("\n");
+
+    element=0;
+    printf("Snapshot contains:\n");
+    while (! iterator_end(&snap)) {
+      printf("%d --> %d / %s with priority %d.\n",
+	     ++element,
+	     ((SomeType *)iterator_pointer(&snap))->a,
+	     ((SomeType *)iterator_pointer(&snap))->buf,
+	     iterator_priority(&snap));
+      iterator_next(&snap);
+    }
+    destroy_iterator(&snap);
+
+    element=0;
+    init_iterator(&q, &outer, FALSE);
+    printf("Queue q contains:\n");
+    while (! iterator_end(&outer)) {
+      printf("%d --> %d / %s with priority %d.\n",
+	     ++element,
+	     ((SomeType *)iterator_pointer(&outer))->a,
+	     ((SomeType *)iterator_pointer(&outer))->buf,
+	     iterator_priority(&outer));
+      iterator_next(&outer);
+    }
+    destroy_iterator(&outer);
+
+    destroy_queue(&q);
+  }
+
+  printf("\n");
+
+  // ----------------------- END OF ITERATOR TESTING ------------------------
+
+  // ------------------- START OF BATCH OPERATION TESTING -------------------
+
+  printf("TESTING BATCH OPERATION FUNCTIONALITY.\n");
+  printf("--------------------------------------\n");
+
+  printf("\n");
+
+  {
+    SomeType batch[4], out[4];
+    int priorities[4], out_priorities[4], i;
+    unsigned long n;
+
+    batch[0]=s2; priorities[0]=s2.a;
+    batch[1]=s1; priorities[1]=s1.a;
+    batch[2]=s4; priorities[2]=s4.a;
+    batch[3]=s3; priorities[3]=s3.a;
+
+    printf("Initializing priority queues q and another_q.\n");
+    init_queue(&q, sizeof(SomeType), TRUE, some_type_compare, FALSE);
+    init_queue(&another_q, sizeof(SomeType), TRUE, some_type_compare, FALSE);
+
+    printf("Adding pre-sorted batch of 4 to q and %d / %s, %d / %s to another_q.\n",
+	   s1.a, s1.buf, s3.a, s3.buf);
+    n=add_many(&q, batch, priorities, 4);
+    printf("add_many() added %lu elements.\n", n);
+    add_to_queue(&another_q, &s1, 6);
+    add_to_queue(&another_q, &s3, 3);
+
+    printf("Draining another_q into q.\n");
+    n=drain_into(&q, &another_q);
+    printf("drain_into() moved %lu elements, another_q now has %lu.\n", n, queue_length(&another_q));
+
+    printf("Removing up to 4 elements from q.\n");
+    n=remove_up_to_n(&q, out, out_priorities, 4);
+    for (i=0; i < (int)n; i++) {
+      printf("%d --> %d / %s with priority %d.\n", i + 1, out[i].a, out[i].buf, out_priorities[i]);
+    }
+    printf("Removing up to 4 more elements from q.\n");
+    n=remove_up_to_n(&q, out, out_priorities, 4);
+    for (i=0; i < (int)n; i++) {
+      printf("%d --> %d / %s with priority %d.\n", i + 1, out[i].a, out[i].buf, out_priorities[i]);
+    }
+    printf("Queue q is %s.\n", empty_queue(&q) ? "empty" : "not empty");
+  }
+
+  printf("\n");
+
+  // -------------------- END OF BATCH OPERATION TESTING --------------------
+
+  // --------------- START OF MULTI-QUEUE TRANSACTION TESTING ---------------
+
+  printf("TESTING MULTI-QUEUE TRANSACTION FUNCTIONALITY.\n");
+  printf("----------------------------------------------\n");
+
+  printf("\n");
+
+  {
+    pthread_t movers[MOVERS];
+    long i;
+
+    printf("Initializing queues left_q and right_q with 500 elements each.\n");
+    init_queue(&left_q, sizeof(long), TRUE, NULL, TRUE);
+    init_queue(&right_q, sizeof(long), TRUE, NULL, TRUE);
+    for (i=0; i < 1000; i++) {
+      add_to_queue(i < 500 ? &left_q : &right_q, &i, 0);
+    }
+
+    printf("Running %d threads moving elements in opposite directions.\n", MOVERS);
+    for (i=0; i < MOVERS; i++) {
+      pthread_create(&movers[i], NULL, mover, (void *)i);
+    }
+    for (i=0; i < MOVERS; i++) {
+      pthread_join(movers[i], NULL);
+    }
+
+    if (queue_length(&left_q) + queue_length(&right_q) == 1000) {
+      printf("No deadlock, and all 1000 elements are still accounted for.\n");
+    }
+    else {
+      printf("Something went wrong!  %lu elements left.\n",
+	     queue_length(&left_q) + queue_length(&right_q));
+    }
+
+    destroy_queue(&left_q);
+    destroy_queue(&right_q);
+  }
+
+  printf("\n");
+
+  // ---------------- END OF MULTI-QUEUE TRANSACTION TESTING ----------------
+
+  // ------------------- START OF BLOCKING REMOVE TESTING -------------------
+
+  printf("TESTING BLOCKING REMOVE FUNCTIONALITY.\n");
+  printf("--------------------------------------\n");
+
+  printf("\n");
+
+  {
+    pthread_t producer, consumers[3];
+    long e;
+    int i;
+
+    printf("Initializing work queue.\n");
+    init_queue(&work_q, sizeof(long), TRUE, NULL, TRUE);
+
+    printf("Waiting 50 ms on the empty queue.\n");
+    printf("Wait %s.\n", remove_from_front_wait(&work_q, &e, 50) ? "returned an element" : "timed out");
+
+    printf("Running 1 producer and 3 blocking consumers.\n");
+    atomic_init(&work_done, 0);
+    for (i=0; i < 3; i++) {
+      pthread_create(&consumers[i], NULL, work_consumer, NULL);
+    }
+    pthread_create(&producer, NULL, work_producer, NULL);
+    pthread_join(producer, NULL);
+    for (i=0; i < 3; i++) {
+      pthread_join(consumers[i], NULL);
+    }
+    printf("Consumers processed %lu of %d elements and stopped once the queue was closed and empty.\n",
+	   atomic_load(&work_done), WORK_ITEMS);
+
+    destroy_queue(&work_q);
+  }
+
+  printf("\n");
+
+  // -------------------- END OF BLOCKING REMOVE TESTING --------------------
+
+  // ------------------- START OF SHARDED QUEUE TESTING -------------------
+
+  printf("TESTING SHARDED QUEUE FUNCTIONALITY.\n");
+  printf("------------------------------------\n");
+
+  printf("\n");
+
+  {
+    pthread_t producers[SHARD_PRODUCERS];
+    long e, last[SHARD_PRODUCERS];
+    unsigned long n;
+    int ordered, prio;
+    long i;
+
+    printf("Initializing globally ordered sharded queue with 4 shards.\n");
+    init_sharded_queue(&shq, sizeof(long), 4, FALSE);
+    for (i=0; i < 10; i++) {
+      sharded_add_to_queue(&shq, &i, 0);
+    }
+    printf("Sharded queue length is %lu.\n", sharded_queue_length(&shq));
+    printf("Removing: ");
+    while (sharded_remove_from_front(&shq, &e, NULL)) {
+      printf("%ld ", e);
+    }
+    printf("\n");
+    destroy_sharded_queue(&shq);
+
+    printf("Initializing relaxed sharded queue with 4 shards.\n");
+    init_sharded_queue(&shq, sizeof(long), 4, TRUE);
+    printf("Running %d producers adding %d elements each.\n", SHARD_PRODUCERS, SHARD_ITEMS);
+    for (i=0; i < SHARD_PRODUCERS; i++) {
+      pthread_create(&producers[i], NULL, shard_producer, (void *)i);
+    }
+    for (i=0; i < SHARD_PRODUCERS; i++) {
+      pthread_join(producers[i], NULL);
+    }
+    for (i=0; i < SHARD_PRODUCERS; i++) {
+      last[i] = -1;
+    }
+    n = 0;
+    ordered = TRUE;
+    while (sharded_remove_from_front(&shq, &e, &prio)) {
+      if (e <= last[prio]) {
+	ordered = FALSE;
+      }
+      last[prio] = e;
+      n++;
+    }
+    printf("Removed %lu elements, per-producer order %s.\n", n,
+	   ordered ? "preserved" : "VIOLATED");
+    printf("Sharded queue is %s.\n", sharded_empty_queue(&shq) ? "empty" : "not empty");
+    destroy_sharded_queue(&shq);
+  }
+
+  printf("\n");
+
+  // -------------------- END OF SHARDED QUEUE TESTING --------------------
+
+  // ------------------ START OF ALLOCATOR AND ARENA TESTING ------------------
+
+  printf("TESTING ALLOCATOR AND ARENA FUNCTIONALITY.\n");
+  printf("------------------------------------------\n");
+
+  printf("\n");
+
+  {
+    Queue_allocator counting = { counting_alloc, counting_release, NULL };
+    Queue_arena arena;
+    Queue aq1, aq2, cq;
+    Queue_element h;
+    unsigned long n;
+    int e, i;
+
+    printf("Initializing arena and two queues on it.\n");
+    init_queue_arena(&arena, 4096, FALSE);
+    init_queue_with_arena(&aq1, sizeof(int), TRUE, NULL, FALSE, &arena);
+    init_queue_with_arena(&aq2, sizeof(int), TRUE, NULL, FALSE, &arena);
+    for (i=0; i < 1000; i++) {
+      add_to_queue(&aq1, &i, i % 10);
+    }
+    printf("Queue 1 length is %lu.\n", queue_length(&aq1));
+
+    printf("Deleting 500 elements and adding them back (reusing freed elements).\n");
+    for (i=0; i < 500; i++) {
+      remove_from_front(&aq1, &e);
+    }
+    for (i=0; i < 500; i++) {
+      add_to_queue(&aq1, &i, 0);
+    }
+    printf("Queue 1 length is %lu.\n", queue_length(&aq1));
+
+    printf("Draining queue 1 into queue 2 (same arena, relinked in place).\n");
+    printf("Moved %lu elements.\n", drain_into(&aq2, &aq1));
+
+    printf("Initializing queue with counting allocator.\n");
+    init_queue_with_allocator(&cq, sizeof(int), TRUE, NULL, FALSE, &counting);
+    printf("Moving front of arena queue to counting queue (copied).\n");
+    rewind_queue(&aq2);
+    h = move_handle(&cq, &aq2, current_handle(&aq2), 5);
+    printf("Moved element holds %d, counting allocator has %lu live element(s).\n",
+	   *(int *) pointer_to_handle(h), live_elements);
+    printf("Draining arena queue into counting queue (copied).\n");
+    n = drain_into(&cq, &aq2);
+    printf("Moved %lu elements, counting allocator has %lu live elements.\n",
+	   n, live_elements);
+    destroy_queue(&cq);
+    printf("After destroying counting queue, %lu live elements.\n", live_elements);
+
+    printf("Destroying arena queues and arena.\n");
+    destroy_queue(&aq1);
+    destroy_queue(&aq2);
+    destroy_queue_arena(&arena);
+
+    printf("Initializing huge-page arena.\n");
+    init_queue_arena(&arena, 1, TRUE);
+    init_queue_with_arena(&aq1, sizeof(int), TRUE, NULL, TRUE, &arena);
+    for (i=0; i < 100000; i++) {
+      add_to_queue(&aq1, &i, 0);
+    }
+    printf("Queue length is %lu, front is %d.\n", queue_length(&aq1),
+	   *(int *) pointer_to_current(&aq1));
+    destroy_queue(&aq1);
+    reset_queue_arena(&arena);
+    destroy_queue_arena(&arena);
+  }
+
+  printf("\n");
+
+  // ------------------- END OF ALLOCATOR AND ARENA TESTING -------------------
+
+  // -------------------- START OF TYPED QUEUE TESTING --------------------
+
+  printf("TESTING TYPED QUEUE FUNCTIONALITY.\n");
+  printf("----------------------------------\n");
+
+  printf("\n");
+
+  {
+    Queue jq;
+    Job j, *jp;
+    int i, prio = 0;
+
+    printf("Initializing typed Job queue, no duplicates.\n");
+    Job_init_queue(&jq, FALSE, FALSE);
+    for (i=0; i < 10; i++) {
+      j.id = i;
+      j.cost = i * 1.5;
+      Job_add_to_queue(&jq, &j, 10 - i);
+    }
+    j.id = 3;
+    printf("Adding duplicate job 3.\n");
+    Job_add_to_queue(&jq, &j, 0);
+    printf("Queue length is %lu.\n", queue_length(&jq));
+    printf("Job 3 is %sin queue, job 42 is %sin queue.\n",
+	   Job_element_in_queue(&jq, &j) ? "" : "not ",
+	   Job_element_in_queue(&jq, &(Job) { 42, 0.0 }) ? "" : "not ");
+    j.id = 7;
+    Job_element_in_queue(&jq, &j);
+    printf("After finding job 7, current job is %d.\n", Job_pointer_to_current(&jq)->id);
+
+    rewind_queue(&jq);
+    jp = Job_pointer_to_current(&jq);
+    printf("Current job is %d with cost %.1f.\n", jp->id, jp->cost);
+    Job_peek_at_current(&jq, &j, &prio);
+    printf("Peeked job %d with priority %d.\n", j.id, prio);
+
+    printf("Deleting job 5 with typed delete.\n");
+    j.id = 5;
+    rewind_queue(&jq);
+    Job_delete_from_queue(&jq, &j);
+    printf("Current job after typed delete is %d.\n", Job_pointer_to_current(&jq)->id);
+    printf("Generic element_in_queue() says job 5 is %sin queue.\n",
+	   element_in_queue(&jq, &j) ? "" : "not ");
+    printf("Deleting job 7 with generic delete.\n");
+    j.id = 7;
+    rewind_queue(&jq);
+    delete_from_queue(&jq, &j);
+    printf("Current job after generic delete is %d.\n", Job_pointer_to_current(&jq)->id);
+
+    printf("Removing: ");
+    while (Job_remove_from_front(&jq, &j)) {
+      printf("%d ", j.id);
+    }
+    printf("\n");
+    destroy_queue(&jq);
+  }
+
+  printf("\n");
+
+  // --------------------- END OF TYPED QUEUE TESTING ---------------------
+
+  // ------------------- START OF BOUNDED QUEUE TESTING -------------------
+
+  printf("TESTING BOUNDED QUEUE FUNCTIONALITY.\n");
+  printf("------------------------------------\n");
+
+  printf("\n");
+
+  {
+    pthread_t producer;
+    long e, expected = 0;
+    int i, in_order = TRUE;
+
+    printf("Initializing queue with capacity %d.\n", BOUNDED_CAPACITY);
+    init_queue(&bounded_q, sizeof(long), TRUE, NULL, TRUE);
+    set_queue_capacity(&bounded_q, BOUNDED_CAPACITY);
+    for (i=0; i < 10; i++) {
+      e = i;
+      if (! try_add_to_queue(&bounded_q, &e, 0)) {
+	printf("try_add_to_queue() refused element %d: queue is full.\n", i);
+      }
+    }
+    printf("Queue length is %lu.\n", queue_length(&bounded_q));
+    printf("Waiting 50 ms to add to the full queue.\n");
+    printf("Add %s.\n", add_to_queue_wait(&bounded_q, &e, 0, 50) ? "succeeded" : "timed out");
+    destroy_queue(&bounded_q);
+
+    printf("Setting watermarks high=6, low=2, then adding 8 and removing 8 elements.\n");
+    set_queue_watermarks(&bounded_q, 6, 2, bounded_watermark, NULL);
+    for (i=0; i < BOUNDED_CAPACITY; i++) {
+      e = i;
+      add_to_queue(&bounded_q, &e, 0);
+    }
+    while (remove_from_front(&bounded_q, &e)) {
+    }
+    printf("Watermark callbacks: %lu high crossing(s), %lu low crossing(s).\n",
+	   high_crossings, low_crossings);
+
+    printf("Setting watermarks high=8, low=7 and filling to 8, then repositioning elements.\n");
+    set_queue_watermarks(&bounded_q, 8, 7, bounded_watermark, NULL);
+    for (i=0; i < BOUNDED_CAPACITY; i++) {
+      e = i;
+      add_to_queue(&bounded_q, &e, 0);
+    }
+    high_crossings = low_crossings = 0;
+    rotate_queue(&bounded_q);
+    update_front(&bounded_q, requeue_element, NULL);
+    update_matching(&bounded_q, NULL, requeue_element, NULL);
+    rewind_queue(&bounded_q);
+    move_handle(&bounded_q, &bounded_q, current_handle(&bounded_q), 0);
+    printf("Watermark callbacks while repositioning: %lu high, %lu low.\n",
+	   high_crossings, low_crossings);
+    while (remove_from_front(&bounded_q, &e)) {
+    }
+    set_queue_watermarks(&bounded_q, 0, 0, NULL, NULL);
+
+    printf("Running a producer that blocks while the queue is full.\n");
+    pthread_create(&producer, NULL, bounded_producer, NULL);
+    while (remove_from_front_wait(&bounded_q, &e, -1)) {
+      if (e != expected++) {
+	in_order = FALSE;
+      }
+    }
+    pthread_join(producer, NULL);
+    printf("Consumed %ld elements %s, queue never exceeded capacity: %s.\n", expected,
+	   in_order ? "in order" : "OUT OF ORDER",
+	   max_bounded_length <= BOUNDED_CAPACITY ? "yes" : "NO");
+    destroy_queue(&bounded_q);
+  }
+
+  printf("\n");
+
+  // -------------------- END OF BOUNDED QUEUE TESTING --------------------
+
+  // ------------------ START OF UPDATE CALLBACK TESTING ------------------
+
+  printf("TESTING UPDATE CALLBACK FUNCTIONALITY.\n");
+  printf("--------------------------------------\n");
+
+  printf("\n");
+
+  {
+    Queue sq;
+    Slice sl;
+    int i, finished = 0, ticks = 0;
+
+    printf("Initializing FIFO queue of slices with quanta 1..4.\n");
+    init_queue(&sq, sizeof(Slice), TRUE, slice_compare, TRUE);
+    for (i=1; i <= 4; i++) {
+      sl.id = i;
+      sl.quantum = i;
+      add_to_queue(&sq, &sl, 0);
+    }
+    printf("Running round robin with update_front() until the queue is empty.\n");
+    while (update_front(&sq, run_slice, &finished) >= 0) {
+      ticks++;
+    }
+    printf("%d ticks, %d slices finished.\n", ticks, finished);
+    destroy_queue(&sq);
+
+    printf("Initializing prioritized queue of slices 1..5, priority = id.\n");
+    init_queue(&sq, sizeof(Slice), TRUE, slice_compare, FALSE);
+    for (i=1; i <= 5; i++) {
+      sl.id = i;
+      sl.quantum = 0;
+      add_to_queue(&sq, &sl, i);
+    }
+    printf("Boosting slice 2 with update_matching().\n");
+    sl.id = 2;
+    printf("Visited %lu element(s).\n", update_matching(&sq, &sl, boost_slice, NULL));
+    printf("Queue order: ");
+    while (remove_from_front(&sq, &sl)) {
+      printf("%d ", sl.id);
+    }
+    printf("\n");
+    destroy_queue(&sq);
+  }
+
+  printf("\n");
+
+  // ------------------- END OF UPDATE CALLBACK TESTING -------------------
+
+  // -------------------- START OF QUEUE FILE TESTING --------------------
+
+  printf("TESTING QUEUE FILE FUNCTIONALITY.\n");
+  printf("---------------------------------\n");
+
+  printf("\n");
+
+  {
+    Queue fq, lq;
+    FILE *fp;
+    char path[] = "/tmp/test-prioque-XXXXXX";
+    long e;
+    int fd;
+
+    printf("Initializing prioritized queue with 200000 elements.\n");
+    init_queue(&fq, sizeof(long), TRUE, NULL, FALSE);
+    for (e=0; e < 200000; e++) {
+      add_to_queue(&fq, &e, (int)(-e / 1000));
+    }
+
+    printf("Saving to a temporary file and loading with load_queue().\n");
+    fp = tmpfile();
+    printf("Save %s.\n", save_queue(&fq, fp) ? "succeeded" : "FAILED");
+    rewind(fp);
+    init_queue(&lq, sizeof(long), TRUE, NULL, FALSE);
+    printf("Load %s.\n", load_queue(&lq, fp) ? "succeeded" : "FAILED");
+    fclose(fp);
+    printf("Loaded queue is %s to the original.\n", equal_queues(&fq, &lq) ? "equal" : "NOT equal");
+    destroy_queue(&lq);
+
+    printf("Saving to a named file and loading with load_queue_mmap().\n");
+    fd = mkstemp(path);
+    fp = fdopen(fd, "w+");
+    save_queue(&fq, fp);
+    init_queue(&lq, sizeof(long), TRUE, NULL, FALSE);
+    printf("Load %s.\n", load_queue_mmap(&lq, path) ? "succeeded" : "FAILED");
+    printf("Loaded queue is %s to the original.\n", equal_queues(&fq, &lq) ? "equal" : "NOT equal");
+    destroy_queue(&lq);
+
+    printf("Corrupting one element and loading again.\n");
+    fseek(fp, 1000, SEEK_SET);
+    fputc(0x55, fp);
+    fflush(fp);
+    printf("Load %s.\n", load_queue_mmap(&lq, path) ? "SUCCEEDED" : "was refused");
+    printf("Loaded queue length is %lu.\n", queue_length(&lq));
+    fclose(fp);
+    unlink(path);
+    destroy_queue(&lq);
+
+    printf("Loading 100 elements through a pipe from a header claiming 2^40.\n");
+    {
+      unsigned char buf[8192];
+      size_t n;
+      int fds[2];
+
+      destroy_queue(&fq);
+      init_queue(&fq, sizeof(long), TRUE, NULL, FALSE);
+      for (e=0; e < 100; e++) {
+	add_to_queue(&fq, &e, (int) e);
+      }
+      fp = tmpfile();
+      save_queue(&fq, fp);
+      n = (size_t) ftell(fp);
+      rewind(fp);
+      n = fread(buf, 1, n, fp);
+      fclose(fp);
+      // the little-endian element count at offset 24
+      memset(buf + 24, 0, 8);
+      buf[29] = 1;
+      if (pipe(fds) == 0) {
+	if (write(fds[1], buf, n) != (ssize_t) n) {
+	  printf("Write to pipe FAILED.\n");
+	}
+	close(fds[1]);
+	fp = fdopen(fds[0], "r");
+	init_queue(&lq, sizeof(long), TRUE, NULL, FALSE);
+	printf("Load %s.\n", load_queue(&lq, fp) ? "SUCCEEDED" : "was refused");
+	fclose(fp);
+	destroy_queue(&lq);
+      }
+    }
+    destroy_queue(&fq);
+  }
+
+  printf("\n");
+
+  // --------------------- END OF QUEUE FILE TESTING ---------------------
+
+  // ------------------ START OF DELTA SNAPSHOT TESTING ------------------
+
+  printf("TESTING DELTA SNAPSHOT FUNCTIONALITY.\n");
+  printf("-------------------------------------\n");
+
+  printf("\n");
+
+  {
+    Queue dq, rq;
+    FILE *base, *delta;
+    long e, *ep;
+    int i, ok;
+
+    printf("Initializing prioritized queue with 10000 elements and tracking changes.\n");
+    init_queue(&dq, sizeof(long), TRUE, NULL, FALSE);
+    for (e=0; e < 10000; e++) {
+      add_to_queue(&dq, &e, (int)(-e / 100));
+    }
+    track_queue_changes(&dq);
+    base = tmpfile();
+    ok = save_queue_snapshot(&dq, base, TRUE);
+    printf("Full snapshot %s, %ld bytes.\n", ok ? "saved" : "FAILED", ftell(base));
+
+    printf("Removing 3 elements, adding 2, updating 1 and reprioritizing 1.\n");
+    for (i=0; i < 3; i++) {
+      remove_from_front(&dq, &e);
+    }
+    e = 424242;
+    add_to_queue(&dq, &e, -50);
+    e = 434343;
+    add_to_queue(&dq, &e, -200);
+    rewind_queue(&dq);
+    for (i=0; i < 5000; i++) {
+      next_element(&dq);
+    }
+    ep = (long *) pointer_to_current(&dq);
+    *ep = -1;
+    mark_handle_dirty(&dq, current_handle(&dq));
+    move_handle(&dq, &dq, add_to_queue_handle(&dq, &e, -99), 0);
+    delta = tmpfile();
+    ok = save_queue_snapshot(&dq, delta, FALSE);
+    printf("Delta snapshot %s, %ld bytes.\n", ok ? "saved" : "FAILED", ftell(delta));
+
+    printf("Applying full snapshot and delta to a new queue.\n");
+    init_queue(&rq, sizeof(long), TRUE, NULL, FALSE);
+    rewind(base);
+    rewind(delta);
+    printf("Full snapshot %s.\n", apply_queue_snapshot(&rq, base) ? "applied" : "FAILED");
+    printf("Delta snapshot %s.\n", apply_queue_snapshot(&rq, delta) ? "applied" : "FAILED");
+    printf("Restored queue is %s to the original.\n", equal_queues(&dq, &rq) ? "equal" : "NOT equal");
+    rewind(delta);
+    printf("Applying the same delta again is %s.\n",
+	   apply_queue_snapshot(&rq, delta) ? "ACCEPTED" : "refused");
+    destroy_queue(&rq);
+
+    printf("Applying the delta to a queue emptied since the full snapshot.\n");
+    init_queue(&rq, sizeof(long), TRUE, NULL, FALSE);
+    rewind(base);
+    rewind(delta);
+    apply_queue_snapshot(&rq, base);
+    while (! empty_queue(&rq)) {
+      remove_from_front(&rq, &e);
+    }
+    printf("Delta snapshot %s, queue length is %lu.\n",
+	   apply_queue_snapshot(&rq, delta) ? "APPLIED" : "refused", queue_length(&rq));
+    fclose(base);
+    fclose(delta);
+    destroy_queue(&rq);
+    destroy_queue(&dq);
+  }
+
+  printf("\n");
+
+  // ------------------- END OF DELTA SNAPSHOT TESTING -------------------
+
+  // ------------------ START OF INSTRUMENTATION TESTING ------------------
+
+  printf("TESTING INSTRUMENTATION FUNCTIONALITY.\n");
+  printf("--------------------------------------\n");
+
+  printf("\n");
+
+  {
+    Queue sq;
+    Queue_stats st;
+    int e;
+
+    printf("Adding 100 elements to a FIFO queue, removing 40, then searching for 1 of them.\n");
+    init_queue(&sq, sizeof(int), TRUE, int_compare, TRUE);
+    report_queue_stats(&sq, "stats-test");
+    for (e=0; e < 100; e++) {
+      add_to_queue(&sq, &e, 0);
+    }
+    for (e=0; e < 40; e++) {
+      remove_from_front(&sq, &e);
+    }
+    e = 49;
+    element_in_queue(&sq, &e);
+    queue_stats(&sq, &st);
+#if defined(PRIOQUE_STATS)
+    printf("adds %lu removes %lu scan_steps %lu compares %lu allocs %lu frees %lu\n",
+	   st.adds, st.removes, st.scan_steps, st.compares, st.allocs, st.frees);
+    printf("locks %lu contended %lu peak_length %lu\n", st.locks, st.contended, st.peak_length);
+    reset_queue_stats(&sq);
+    queue_stats(&sq, &st);
+    printf("After reset: adds %lu locks %lu peak_length %lu\n", st.adds, st.locks, st.peak_length);
+#else
+    printf("Built without PRIOQUE_STATS; counters read as %s.\n",
+	   st.adds == 0 && st.locks == 0 && st.peak_length == 0 ? "zero" : "NONZERO");
+#endif
+    destroy_queue(&sq);
+  }
+
+  printf("\n");
+
+  // ------------------- END OF INSTRUMENTATION TESTING -------------------
+}